@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <wayland-client.h>
 
+#include "../common/pool.h"
 #include "../common/shm.h"
 
 #include "display.h"
@@ -12,12 +13,39 @@ static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
 	struct buffer *buffer = data;
 	buffer->busy = 0;
+
+	if (buffer->on_release)
+		buffer->on_release(buffer->on_release_data);
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
 	.release = wl_buffer_release,
 };
 
+// Like the pool, but with a memfd and mapping of its own
+static int create_standalone(struct buffer *buffer, struct display *display,
+		int width, int height, int stride, int size)
+{
+	int fd = allocate_shm_file(size);
+	if (fd < 0)
+		return -1;
+
+	buffer->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buffer->data == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(display->wl_shm, fd, size);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
+			width, height, stride, WL_SHM_FORMAT_XRGB8888);
+
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return 0;
+}
+
 struct buffer *create_buffer(struct display *display, int width, int height)
 {
 	const int stride = width * 4;
@@ -26,19 +54,22 @@ struct buffer *create_buffer(struct display *display, int width, int height)
 	struct buffer *buffer = calloc(1, sizeof(*buffer));
 	buffer->busy = 0;
 
-	int fd = allocate_shm_file(size);
-	struct wl_shm_pool *pool = wl_shm_create_pool(display->wl_shm, fd,  size);
-
-	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
-			width, height, stride, WL_SHM_FORMAT_XRGB8888);
-	buffer->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// Buffers are cut from the display's shared pool, or get a file of their
+	// own if there is none or its address range is used up
+	buffer->block = display->shm_pool ? shm_pool_alloc(display->shm_pool, size) : NULL;
+	if (buffer->block) {
+		buffer->wl_buffer = shm_block_create_buffer(buffer->block,
+				width, height, stride, WL_SHM_FORMAT_XRGB8888);
+		buffer->data = buffer->block->data;
+	} else if (create_standalone(buffer, display, width, height, stride, size) < 0) {
+		free(buffer);
+		return NULL;
+	}
 	buffer->size = size;
+	buffer->shm_flags = advise_shm(buffer->data, size, display->shm_flags);
 
 	wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
 
-	wl_shm_pool_destroy(pool);
-	close(fd);
-
 	return buffer;
 }
 
@@ -47,7 +78,12 @@ void destroy_buffer(struct buffer *buffer)
 	if (buffer->wl_buffer)
 		wl_buffer_destroy(buffer->wl_buffer);
 
-	if (buffer->data)
+	if (buffer->shm_flags & SHM_LOCK)
+		munlock(buffer->data, buffer->size);
+
+	if (buffer->block)
+		shm_pool_free(buffer->block);
+	else if (buffer->data)
 		munmap(buffer->data, buffer->size);
 
 	free(buffer);
@@ -2,12 +2,25 @@
 #define BUFFER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct buffer {
 	struct wl_buffer *wl_buffer;
+	struct shm_block *block;
 	void *data;
 	size_t size;
 	int busy;
+
+	// Content key of what was last drawn into it, see window_set_content_key()
+	uint64_t key;
+	int has_key;
+
+	// SHM_* flags that took effect
+	int shm_flags;
+
+	// Called when the compositor releases the buffer
+	void (*on_release)(void *data);
+	void *on_release_data;
 };
 
 struct buffer *create_buffer(struct display *display, int width, int height);
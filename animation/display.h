@@ -8,6 +8,11 @@ struct display {
 	struct wl_compositor *wl_compositor;
 	struct wl_seat *wl_seat;
 	struct xdg_wm_base *xdg_wm_base;
+
+	// Backing memory for all buffers
+	struct shm_pool *shm_pool;
+	// SHM_* flags applied to new buffers
+	int shm_flags;
 };
 
 struct display *create_display();
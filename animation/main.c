@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <wayland-client.h>
 
+#include "../common/shm.h"
+#include "../common/pattern.h"
+
 #include "display.h"
 #include "window.h"
 #include "input.h"
@@ -11,6 +15,9 @@ const uint32_t KEY_ESC = 1;
 const int WIDTH = 512;
 const int HEIGHT = 512;
 
+// Swapchain depth, 2-4
+const int BUFFERS = 3;
+
 static int running = 1;
 
 static void on_close()
@@ -20,16 +27,14 @@ static void on_close()
 
 static void on_draw(uint32_t *pixels, uint32_t time)
 {
-	for (int y=0; y<HEIGHT; y++) {
-		for (int x=0; x<WIDTH; x++) {
-			uint32_t d1 = time / 10;
-			uint32_t d2 = time / 5;
-			uint8_t r = (x + d2) ^ y;
-			uint8_t g = (x + d1) ^ (y + d2);
-			uint8_t b = x  ^ (y + d1);
-			pixels[y * WIDTH + x] = (r << 16) + (g << 8) + b;
-		}
-	}
+	pattern_fill(pixels, WIDTH, HEIGHT, time);
+}
+
+// on_draw only looks at time / 10 and time / 5, and the first follows from the
+// second
+static uint64_t content_key(uint32_t time)
+{
+	return time / 5;
 }
 
 static void on_key(uint32_t key)
@@ -47,7 +52,20 @@ int main(int argc, char **argv)
   struct input *input;
 
   display = create_display();
-  window = create_window(display, WIDTH, HEIGHT, on_draw, on_close);
+
+  for (int i = 1; i < argc; i++) {
+	  if (strcmp(argv[i], "--prefault") == 0)
+		  display->shm_flags |= SHM_POPULATE;
+	  else if (strcmp(argv[i], "--mlock") == 0)
+		  display->shm_flags |= SHM_LOCK;
+  }
+
+  window = create_window(display, WIDTH, HEIGHT, BUFFERS, on_draw, on_close);
+  if (!window) {
+	  destroy_display(display);
+	  return 1;
+  }
+  window_set_content_key(window, content_key);
   input = create_input(display, on_key);
 
   while (running && wl_display_dispatch(display->wl_display) != -1) {
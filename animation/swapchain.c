@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "display.h"
+#include "buffer.h"
+#include "swapchain.h"
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void buffer_release(void *data)
+{
+	struct swapchain *swapchain = data;
+
+	if (swapchain->on_release)
+		swapchain->on_release(swapchain->data);
+}
+
+struct swapchain *create_swapchain(struct display *display, int width, int height,
+		int count, void (*on_release)(void *data), void *data)
+{
+	struct swapchain *swapchain;
+
+	swapchain = calloc(1, sizeof(*swapchain));
+	swapchain->count = MAX(SWAPCHAIN_MIN_BUFFERS, MIN(count, SWAPCHAIN_MAX_BUFFERS));
+	swapchain->on_release = on_release;
+	swapchain->data = data;
+
+	for (int i = 0; i < swapchain->count; i++) {
+		struct buffer *buffer = create_buffer(display, width, height);
+		if (!buffer) {
+			// Make do with the buffers we got
+			fprintf(stderr, "Got only %d of %d buffers\n", i, swapchain->count);
+			swapchain->count = i;
+			break;
+		}
+		buffer->on_release = buffer_release;
+		buffer->on_release_data = swapchain;
+		swapchain->buffers[i] = buffer;
+	}
+
+	if (swapchain->count == 0) {
+		free(swapchain);
+		return NULL;
+	}
+
+	return swapchain;
+}
+
+void destroy_swapchain(struct swapchain *swapchain)
+{
+	for (int i = 0; i < swapchain->count; i++)
+		destroy_buffer(swapchain->buffers[i]);
+
+	free(swapchain);
+}
+
+struct buffer *swapchain_acquire(struct swapchain *swapchain)
+{
+	struct buffer *buffer = NULL;
+	for (int i = 0; i < swapchain->count; i++) {
+		if (!swapchain->buffers[i]->busy) {
+			buffer = swapchain->buffers[i];
+			break;
+		}
+	}
+
+	if (!buffer) {
+		if (!swapchain->stalled) {
+			swapchain->stalled = 1;
+			swapchain->stall_start = now_ns();
+			swapchain->stalls++;
+		}
+
+		return NULL;
+	}
+
+	if (swapchain->stalled) {
+		uint64_t wait = now_ns() - swapchain->stall_start;
+		swapchain->stall_ns += wait;
+		swapchain->max_stall_ns = MAX(swapchain->max_stall_ns, wait);
+		swapchain->stalled = 0;
+	}
+
+	swapchain->frames++;
+
+	return buffer;
+}
+
+struct buffer *swapchain_find(struct swapchain *swapchain, uint64_t key)
+{
+	for (int i = 0; i < swapchain->count; i++) {
+		struct buffer *buffer = swapchain->buffers[i];
+		if (!buffer->busy && buffer->has_key && buffer->key == key)
+			return buffer;
+	}
+
+	return NULL;
+}
+
+void swapchain_print_stats(struct swapchain *swapchain)
+{
+	fprintf(stderr, "swapchain: %d buffers, %d frames, %d stalls, "
+			"waited %.3f ms total, %.3f ms max\n",
+			swapchain->count, swapchain->frames, swapchain->stalls,
+			swapchain->stall_ns / 1e6, swapchain->max_stall_ns / 1e6);
+}
@@ -0,0 +1,39 @@
+#ifndef SWAPCHAIN_H
+#define SWAPCHAIN_H
+
+#include <stdint.h>
+
+#define SWAPCHAIN_MIN_BUFFERS 2
+#define SWAPCHAIN_MAX_BUFFERS 4
+
+struct swapchain {
+	struct buffer *buffers[SWAPCHAIN_MAX_BUFFERS];
+	int count;
+
+	// Called whenever one of the buffers is released
+	void (*on_release)(void *data);
+	void *data;
+
+	// Stall tracking
+	int stalled;
+	uint64_t stall_start;
+
+	int frames;
+	int stalls;
+	uint64_t stall_ns;
+	uint64_t max_stall_ns;
+};
+
+struct swapchain *create_swapchain(struct display *display, int width, int height,
+		int count, void (*on_release)(void *data), void *data);
+void destroy_swapchain(struct swapchain *swapchain);
+
+// Returns a buffer the compositor isn't holding, or NULL if all are busy
+struct buffer *swapchain_acquire(struct swapchain *swapchain);
+
+// Returns a buffer the compositor isn't holding that was drawn with key
+struct buffer *swapchain_find(struct swapchain *swapchain, uint64_t key);
+
+void swapchain_print_stats(struct swapchain *swapchain);
+
+#endif
@@ -1,12 +1,16 @@
-#include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <wayland-client.h>
 
 #include "../protocols/xdg-shell.h"
 
+#include "log.h"
+
 #include "display.h"
 #include "window.h"
 #include "buffer.h"
+#include "swapchain.h"
 
 static void frame(void *data, struct wl_callback *wl_callback, uint32_t time);
 
@@ -18,28 +22,94 @@ static void noop()
 {
 }
 
+static void request_frame(struct window *window)
+{
+	struct wl_callback *frame_callback = wl_surface_frame(window->wl_surface);
+	wl_callback_add_listener(frame_callback, &frame_listener, window);
+}
+
 static void frame(void *data, struct wl_callback *wl_callback, uint32_t time)
 {
 	struct window *window = data;
-	struct buffer *buffer = window->buffers[window->current_buffer_index];
 
-	assert(!buffer->busy);
+	if (wl_callback)
+		wl_callback_destroy(wl_callback);
 
-	if (window->on_draw)
-		window->on_draw(buffer->data, time);
+	window->last_time = time;
 
-	// Request next frame
-	struct wl_callback *frame_callback = wl_surface_frame(window->wl_surface);
-	wl_callback_add_listener(frame_callback, &frame_listener, window);
+	uint64_t key = window->content_key ? window->content_key(time) : 0;
+
+	// Already on screen, commit just the frame callback with no new
+	// content for the compositor to repaint
+	if (window->content_key && window->shown && key == window->shown_key) {
+		window->frame_pending = 0;
+		window->frames_skipped++;
+
+		request_frame(window);
+		wl_surface_commit(window->wl_surface);
+		return;
+	}
+
+	// A free buffer may still hold these pixels from before
+	struct buffer *buffer = NULL;
+	if (window->content_key)
+		buffer = swapchain_find(window->swapchain, key);
+
+	int reused = buffer != NULL;
+
+	if (buffer) {
+		window->frames_reused++;
+	} else {
+		buffer = swapchain_acquire(window->swapchain);
+		if (!buffer) {
+			// Compositor still holds every buffer, pick up again on release
+			window->frame_pending = 1;
+			return;
+		}
+
+		struct rusage usage_start;
+		getrusage(RUSAGE_SELF, &usage_start);
+
+		if (window->on_draw)
+			window->on_draw(buffer->data, time);
+
+		struct rusage usage_end;
+		getrusage(RUSAGE_SELF, &usage_end);
+		LOG("Draw: %ld minor, %ld major faults",
+				usage_end.ru_minflt - usage_start.ru_minflt,
+				usage_end.ru_majflt - usage_start.ru_majflt);
+
+		buffer->key = key;
+		buffer->has_key = window->content_key != NULL;
+		window->frames_drawn++;
+	}
+
+	window->frame_pending = 0;
+
+	request_frame(window);
 
 	wl_surface_attach(window->wl_surface, buffer->wl_buffer, 0, 0);
-	wl_surface_damage_buffer(window->wl_surface, 0, 0, window->width, window->height);
+
+	// A reused buffer is a whole frame apart from what's on screen
+	if (damage_tracker_empty(&window->damage) || reused)
+		window_damage(window, 0, 0, window->width, window->height);
+	damage_tracker_submit(&window->damage, window->wl_surface,
+			window->width, window->height);
+
 	wl_surface_commit(window->wl_surface);
 
 	buffer->busy = 1;
 
-	// Switch to the other buffer
-	window->current_buffer_index = 1 - window->current_buffer_index;
+	window->shown_key = key;
+	window->shown = 1;
+}
+
+static void buffer_release(void *data)
+{
+	struct window *window = data;
+
+	if (window->frame_pending)
+		frame(window, NULL, window->last_time);
 }
 
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
@@ -72,7 +142,7 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 	.close = xdg_toplevel_close,
 };
 
-struct window *create_window(struct display *display, int width, int height, void (*on_draw)(uint32_t *pixels, uint32_t time), void (*on_close)())
+struct window *create_window(struct display *display, int width, int height, int buffer_count, void (*on_draw)(uint32_t *pixels, uint32_t time), void (*on_close)())
 {
 	struct window *window;
 
@@ -84,8 +154,15 @@ struct window *create_window(struct display *display, int width, int height, voi
 	window->on_close = on_close;
 	window->configured = 0;
 
-	window->buffers[0] = create_buffer(display, width, height);
-	window->buffers[1] = create_buffer(display, width, height);
+	damage_tracker_init(&window->damage, 8);
+
+	window->swapchain = create_swapchain(display, width, height, buffer_count,
+			buffer_release, window);
+	if (!window->swapchain) {
+		damage_tracker_finish(&window->damage);
+		free(window);
+		return NULL;
+	}
 
 	window->wl_surface = wl_compositor_create_surface(display->wl_compositor);
 	window->xdg_surface = xdg_wm_base_get_xdg_surface(display->xdg_wm_base,
@@ -106,12 +183,32 @@ struct window *create_window(struct display *display, int width, int height, voi
 	return window;
 }
 
+void window_damage(struct window *window, int x, int y, int width, int height)
+{
+	damage_tracker_add(&window->damage, x, y, width, height);
+}
+
+void window_set_content_key(struct window *window, uint64_t (*content_key)(uint32_t time))
+{
+	window->content_key = content_key;
+	window->shown = 0;
+}
+
 void destroy_window(struct window *window)
 {
-	if (window->buffers[0])
-		destroy_buffer(window->buffers[0]);
-	if (window->buffers[1])
-		destroy_buffer(window->buffers[1]);
+	if (window->content_key) {
+		fprintf(stderr, "frames: %d drawn, %d reused, %d skipped\n",
+				window->frames_drawn, window->frames_reused,
+				window->frames_skipped);
+	}
+
+	damage_tracker_print_stats(&window->damage, stderr);
+	damage_tracker_finish(&window->damage);
+
+	if (window->swapchain) {
+		swapchain_print_stats(window->swapchain);
+		destroy_swapchain(window->swapchain);
+	}
 
 	if (window->xdg_toplevel)
 		xdg_toplevel_destroy(window->xdg_toplevel);
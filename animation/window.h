@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "damage.h"
+
 struct window {
 	struct display *display;
 
@@ -17,16 +19,39 @@ struct window {
 	int width;
 	int height;
 
-	struct buffer *buffers[2];
-	int current_buffer_index;
+	struct swapchain *swapchain;
+
+	// Set when a frame was skipped because every buffer was busy
+	int frame_pending;
+	uint32_t last_time;
 
 	void (*on_draw)(uint32_t *pixels, uint32_t time);
 	void (*on_close)();
 
+	// Frame memoization, see window_set_content_key()
+	uint64_t (*content_key)(uint32_t time);
+	uint64_t shown_key;
+	int shown;
+
+	// Damage for the next frame, everything if none was added
+	struct damage_tracker damage;
+
+	int frames_drawn;
+	int frames_reused;
+	int frames_skipped;
+
 	int configured;
 };
 
-struct window *create_window(struct display *display, int width, int height, void (*on_draw)(uint32_t *pixels, uint32_t time), void (*on_close)());
+struct window *create_window(struct display *display, int width, int height, int buffer_count, void (*on_draw)(uint32_t *pixels, uint32_t time), void (*on_close)());
 void destroy_window(struct window *window);
 
+// Mark part of the window as changed for the next frame
+void window_damage(struct window *window, int x, int y, int width, int height);
+
+// content_key returns a key that is equal for two frame times only if on_draw
+// would draw the same pixels for both. Frames whose key is already on screen
+// are skipped, and ones a free buffer was drawn with reuse that buffer.
+void window_set_content_key(struct window *window, uint64_t (*content_key)(uint32_t time));
+
 #endif
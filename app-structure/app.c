@@ -1,18 +1,27 @@
 #include <assert.h>
-#include <poll.h>
+#include <pixman.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <sys/param.h>
-#include <sys/timerfd.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
 #include "../protocols/xdg-shell.h"
 
 #include "app.h"
+#include "damage.h"
+#include "diff.h"
 #include "log.h"
+#include "loop.h"
+#include "pixel.h"
+#include "premultiply.h"
+#include "shm.h"
+#include "timers.h"
 
 static struct {
 	struct wl_display *wl_display;
@@ -21,6 +30,10 @@ static struct {
 	struct wl_compositor *wl_compositor;
 	struct wl_seat *wl_seat;
 	struct xdg_wm_base *xdg_wm_base;
+
+	// Advertised through wl_shm.format
+	uint32_t formats[64];
+	int n_formats;
 } globals;
 
 static struct {
@@ -31,35 +44,152 @@ static struct {
 
 static struct {
 	void (*on_key)(uint32_t key);
-	void (*on_draw)(uint32_t *pixels, int width, int height);
+	void (*on_draw)(void *pixels, int width, int height, uint32_t format,
+			const struct damage *damage);
 
 	int width;
 	int height;
+	uint32_t format;
+
+	// Damage for the next frame, relative to the last one shown
+	struct damage damage;
+
+	// Pixels the content moved left since the last frame, see app_scroll()
+	int scroll_dx;
+	// Pixels it moved left in total, and as of the frame being drawn
+	int scroll_x;
+	int drawn_scroll_x;
+	// Buffer committed last
+	struct buffer *shown;
+
+	// Merges app.damage into what's sent to the compositor
+	struct damage_tracker damage_tracker;
+
+	// Set with app_infer_damage(), damage comes from diffing frames
+	int infer_damage;
+	struct frame_diff diff;
 
 	int running;
+	int suspended;
 } app;
 
 static struct {
-	int fd;
+	struct event_loop *loop;
+	struct event_source *wayland;
+
+	// Every app timer, on one timerfd
+	struct timer_heap *timers;
+
+	// Set once the Wayland fd was read in this round
+	int read;
+} events;
+
+// With app_use_render_thread(), frames are drawn on a thread of their own
+// while the main thread keeps handling input, configures and timers
+static struct {
+	int enabled;
+	pthread_t thread;
 
-	void (*on_timer)();
-} timer;
+	// Guards app state the main thread changes while a frame is drawn: size,
+	// format, suspended, damage and scroll_dx, plus the requests below
+	pthread_mutex_t lock;
+
+	// Frame callbacks and buffer releases are dispatched here, by the render
+	// thread alone
+	struct wl_event_queue *queue;
+	struct wl_surface *wl_surface;
+	struct wl_shm *wl_shm;
+
+	struct event_loop *loop;
+	int wake_fd;
+	int read;
+
+	// Requests from the main thread
+	int configure;
+	int redraw;
+	int reclaim;
+	int quit;
+} render = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 static struct buffer {
 	int fd;
 	struct wl_buffer *wl_buffer;
 
-	uint32_t *pixels;
+	void *pixels;
 	int size;
 
 	int width;
 	int height;
+	uint32_t format;
+
+	// Frames since this buffer was last shown, 0 if its contents are undefined
+	int age;
+	// What changed on screen since this buffer was last shown
+	struct damage damage;
+
+	// Pages handed back to the kernel, contents read as zeros
+	int reclaimed;
 
 	int busy;
 } buffers[2];
 
 static void noop() {}
 
+// Damage is kept as disjoint rects, so a pixel is never drawn or premultiplied
+// twice. Overlaps are split up, rects within others dropped.
+static void damage_add(struct damage *damage, struct rect rect)
+{
+	if (rect.width <= 0 || rect.height <= 0)
+		return;
+
+	pixman_region32_t region;
+	pixman_region32_init_rect(&region, rect.x, rect.y, rect.width, rect.height);
+	for (int i = 0; i < damage->n; i++) {
+		struct rect r = damage->rects[i];
+		pixman_region32_union_rect(&region, &region, r.x, r.y, r.width, r.height);
+	}
+
+	int n;
+	pixman_box32_t *boxes = pixman_region32_rectangles(&region, &n);
+
+	// Out of slots, fall back to a single bounding box
+	if (n > MAX_DAMAGE_RECTS) {
+		boxes = pixman_region32_extents(&region);
+		n = 1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		damage->rects[i] = (struct rect){ boxes[i].x1, boxes[i].y1,
+				boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1 };
+	}
+	damage->n = n;
+
+	pixman_region32_fini(&region);
+}
+
+static void damage_union(struct damage *damage, const struct damage *other)
+{
+	for (int i = 0; i < other->n; i++)
+		damage_add(damage, other->rects[i]);
+}
+
+static void damage_clip(struct damage *damage, int width, int height)
+{
+	int n = damage->n;
+	damage->n = 0;
+
+	for (int i = 0; i < n; i++) {
+		struct rect r = damage->rects[i];
+		int x1 = MAX(r.x, 0);
+		int y1 = MAX(r.y, 0);
+		int x2 = MIN(r.x + r.width, width);
+		int y2 = MIN(r.y + r.height, height);
+		damage_add(damage, (struct rect){ x1, y1, x2 - x1, y2 - y1 });
+	}
+}
+
 static void registry_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version)
 {
@@ -81,7 +211,7 @@ static void registry_global(void *data, struct wl_registry *registry,
 
 	else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
 		globals.xdg_wm_base =
-				wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+				wl_registry_bind(registry, name, &xdg_wm_base_interface, MIN(version, 6));
 	}
 	// clang-format on
 }
@@ -91,43 +221,95 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = noop,
 };
 
+static void buffer_reclaim(struct buffer *buffer)
+{
+	if (buffer->busy || buffer->reclaimed || !buffer->pixels)
+		return;
+
+	size_t rss = get_rss();
+	punch_shm_file(buffer->fd, 0, buffer->size);
+	LOG("Reclaimed %dx%d buffer, RSS %zu -> %zu KiB", buffer->width, buffer->height,
+			rss / 1024, get_rss() / 1024);
+
+	buffer->reclaimed = 1;
+	buffer->age = 0;
+	buffer->damage.n = 0;
+}
+
+// Idle buffers are given back to the kernel while hidden, or once the window
+// has shrunk below them
+static void buffers_reclaim()
+{
+	pthread_mutex_lock(&render.lock);
+	int suspended = app.suspended;
+	int width = app.width;
+	int height = app.height;
+	pthread_mutex_unlock(&render.lock);
+
+	for (int i = 0; i < 2; i++) {
+		struct buffer *buffer = &buffers[i];
+		if (suspended || buffer->width != width || buffer->height != height)
+			buffer_reclaim(buffer);
+	}
+}
+
+static void wl_shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+	if (globals.n_formats < sizeof(globals.formats) / sizeof(globals.formats[0]))
+		globals.formats[globals.n_formats++] = format;
+}
+
+static const struct wl_shm_listener wl_shm_listener = {
+	.format = wl_shm_format,
+};
+
 static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
 	struct buffer *buffer = data;
 
 	buffer->busy = 0;
+
+	buffers_reclaim();
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
 	.release = wl_buffer_release,
 };
 
-static struct buffer *get_buffer(int width, int height)
+static struct buffer *get_buffer(int width, int height, uint32_t format)
 {
 	struct buffer *buffer = &buffers[0];
 	if (buffer->busy) buffer = &buffers[1];
 	if (buffer->busy) return NULL;
 
 	// Reuse existing buffer if compatible
-	if (buffer->width == width && buffer->height == height)
+	if (buffer->width == width && buffer->height == height &&
+			buffer->format == format)
 		return buffer;
 
+	buffer->age = 0;
+	buffer->damage.n = 0;
+
 	if (buffer->wl_buffer) wl_buffer_destroy(buffer->wl_buffer);
 	if (buffer->pixels) munmap(buffer->pixels, buffer->size);
 
-	int stride = width * sizeof(uint32_t);
+	int stride = width * pixel_size(format);
 	int size = stride * height;
 
 	if (buffer->fd == 0)
 		buffer->fd = memfd_create("buffer-pool", 0);
 	ftruncate(buffer->fd, size);
 
-	struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(globals.wl_shm, buffer->fd, size);
+	// The buffer inherits the pool's queue, so releases reach the thread
+	// that draws into it
+	struct wl_shm *wl_shm = render.enabled ? render.wl_shm : globals.wl_shm;
+	struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(wl_shm, buffer->fd, size);
 
-	buffer->wl_buffer = wl_shm_pool_create_buffer(wl_shm_pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(wl_shm_pool, 0, width, height, stride, format);
 	buffer->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
 	buffer->width = width;
 	buffer->height = height;
+	buffer->format = format;
 	buffer->size = size;
 
 	wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
@@ -136,25 +318,166 @@ static struct buffer *get_buffer(int width, int height)
 	return buffer;
 }
 
+// Fills buffer with what shown holds moved dx pixels to the left, returns the
+// columns left uncovered. shown may be buffer itself, hence memmove.
+static struct rect buffer_scroll(struct buffer *buffer, struct buffer *shown, int dx)
+{
+	const int bpp = pixel_size(buffer->format);
+	const int stride = buffer->width * bpp;
+	const int kept = buffer->width - abs(dx);
+
+	for (int y = 0; y < buffer->height; y++) {
+		uint8_t *dst = (uint8_t *) buffer->pixels + y * stride;
+		uint8_t *src = (uint8_t *) shown->pixels + y * stride;
+
+		if (dx > 0)
+			memmove(dst, src + dx * bpp, kept * bpp);
+		else
+			memmove(dst - dx * bpp, src, kept * bpp);
+	}
+
+	if (dx > 0)
+		return (struct rect){ kept, 0, dx, buffer->height };
+	else
+		return (struct rect){ 0, 0, -dx, buffer->height };
+}
+
 static void frame(void *data, struct wl_callback *wl_callback, uint32_t time)
 {
-	struct buffer *buffer = get_buffer(app.width, app.height);
+	if (wl_callback)
+		wl_callback_destroy(wl_callback);
+
+	pthread_mutex_lock(&render.lock);
+	struct buffer *buffer = get_buffer(app.width, app.height, app.format);
 
 	if (!buffer) {
+		pthread_mutex_unlock(&render.lock);
 		LOG("All buffers busy");
 
 		return;
 	}
 
+	// Take what the main thread marked so far, anything newer goes to the
+	// next frame
+	struct damage damage = app.damage;
+	int scroll_dx = app.scroll_dx;
+	app.drawn_scroll_x = app.scroll_x;
+	app.damage.n = 0;
+	app.scroll_dx = 0;
+	pthread_mutex_unlock(&render.lock);
+
+	struct rect full = { 0, 0, buffer->width, buffer->height };
+
+	// The previous frame can be moved over if it's still intact and the
+	// same size, leaving just the uncovered columns to draw
+	struct buffer *shown = app.shown;
+	int scroll = scroll_dx != 0 && abs(scroll_dx) < buffer->width &&
+			shown && shown->age > 0 && shown->width == buffer->width &&
+			shown->height == buffer->height && shown->format == buffer->format;
+
+	// Whatever the app marked is relative to the scrolled content
+	struct damage marked = damage;
+
+	// Nothing specific was damaged, or everything moved, so everything was
+	if (damage.n == 0 || scroll_dx != 0)
+		damage_add(&damage, full);
+	damage_clip(&damage, buffer->width, buffer->height);
+
+	// Repaint whatever changed since this buffer was last on screen
+	struct damage repaint = { 0 };
+	if (scroll) {
+		damage_add(&repaint, buffer_scroll(buffer, shown, scroll_dx));
+		damage_union(&repaint, &marked);
+		damage_clip(&repaint, buffer->width, buffer->height);
+
+		LOG("Scrolled %d px from the last frame", scroll_dx);
+	} else if (buffer->age == 0)
+		damage_add(&repaint, full);
+	else {
+		repaint = buffer->damage;
+		damage_union(&repaint, &damage);
+	}
+
+	LOG("Buffer age %d, repainting %d rects", buffer->age, repaint.n);
+
 	if (app.on_draw)
-		app.on_draw(buffer->pixels, buffer->width, buffer->height);
+		app.on_draw(buffer->pixels, buffer->width, buffer->height, buffer->format, &repaint);
+
+	// Only what was just drawn, the rest is premultiplied already. A second
+	// pass would darken translucent pixels, so go by the boxes of the union
+	// rather than trusting the rects not to overlap.
+	if (buffer->format == WL_SHM_FORMAT_ARGB8888) {
+		pixman_region32_t region;
+		pixman_region32_init(&region);
+		for (int i = 0; i < repaint.n; i++) {
+			struct rect r = repaint.rects[i];
+			pixman_region32_union_rect(&region, &region, r.x, r.y, r.width, r.height);
+		}
+
+		int n;
+		pixman_box32_t *boxes = pixman_region32_rectangles(&region, &n);
+		for (int i = 0; i < n; i++) {
+			premultiply_argb8888(buffer->pixels, buffer->width * 4, boxes[i].x1,
+					boxes[i].y1, boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1);
+		}
+
+		pixman_region32_fini(&region);
+	}
+
+	// Replace the damage with what actually changed on screen
+	if (app.infer_damage) {
+		struct diff_rect rects[MAX_DAMAGE_RECTS];
+		int n = frame_diff_update(&app.diff, buffer->pixels, buffer->width,
+				buffer->height, pixel_size(buffer->format), rects, MAX_DAMAGE_RECTS);
+
+		damage.n = 0;
+		for (int i = 0; i < n; i++) {
+			struct diff_rect r = rects[i];
+			damage_add(&damage, (struct rect){ r.x, r.y, r.width, r.height });
+		}
+
+		LOG("Inferred %d damage rects, %.1f%% damaged so far", n,
+				100.0 * app.diff.damaged / app.diff.pixels);
+	}
 
 	wl_surface_attach(surface.wl_surface, buffer->wl_buffer, 0, 0);
-	wl_surface_damage_buffer(surface.wl_surface, 0, 0, buffer->width,
-			buffer->height);
+	for (int i = 0; i < damage.n; i++) {
+		struct rect r = damage.rects[i];
+		damage_tracker_add(&app.damage_tracker, r.x, r.y, r.width, r.height);
+	}
+	damage_tracker_submit(&app.damage_tracker, surface.wl_surface,
+			buffer->width, buffer->height);
 	wl_surface_commit(surface.wl_surface);
 
 	buffer->busy = 1;
+	buffer->reclaimed = 0;
+
+	// Age the buffers and hand this frame's damage to the ones not shown
+	for (int i = 0; i < 2; i++) {
+		struct buffer *other = &buffers[i];
+		if (other == buffer) {
+			other->age = 1;
+			other->damage.n = 0;
+		} else if (other->age > 0) {
+			other->age++;
+			damage_union(&other->damage, &damage);
+		}
+	}
+
+	app.shown = buffer;
+
+	buffers_reclaim();
+}
+
+// Hands a request to the render thread, e.g. render_post(&render.redraw)
+static void render_post(int *request)
+{
+	pthread_mutex_lock(&render.lock);
+	*request = 1;
+	pthread_mutex_unlock(&render.lock);
+
+	uint64_t one = 1;
+	write(render.wake_fd, &one, sizeof(one));
 }
 
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
@@ -162,7 +485,10 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 {
 	xdg_surface_ack_configure(xdg_surface, serial);
 
-	frame(NULL, NULL, 0);
+	if (render.enabled)
+		render_post(&render.configure);
+	else
+		frame(NULL, NULL, 0);
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -173,8 +499,26 @@ static void xdg_toplevel_configure(void *data,
 		struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height,
 		struct wl_array *states)
 {
+	int suspended = 0;
+	uint32_t *state;
+	wl_array_for_each(state, states) {
+		if (*state == XDG_TOPLEVEL_STATE_SUSPENDED)
+			suspended = 1;
+	}
+
+	pthread_mutex_lock(&render.lock);
 	if (width > 0) app.width = width;
 	if (height > 0) app.height = height;
+	app.suspended = suspended;
+	pthread_mutex_unlock(&render.lock);
+
+	if (!suspended)
+		return;
+
+	if (render.enabled)
+		render_post(&render.reclaim);
+	else
+		buffers_reclaim();
 }
 
 static void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
@@ -211,18 +555,37 @@ static const struct wl_callback_listener frame_listener = {
 	.done = frame,
 };
 
+static void on_wayland(int fd, uint32_t mask, void *data)
+{
+	events.read = 1;
+
+	if (wl_display_read_events(globals.wl_display) < 0) {
+		LOG("Lost the connection to the compositor");
+		app_stop();
+	}
+}
+
+static void on_signal(int signal, void *data)
+{
+	app_stop();
+}
+
 void app_init(int width, int height,
 		const char *title,
 		const char *app_id,
 		void (*on_key)(uint32_t key),
-		void (*on_draw)(uint32_t *pixels, int width, int height))
+		void (*on_draw)(void *pixels, int width, int height, uint32_t format,
+				const struct damage *damage))
 {
 	app.width = width;
 	app.height = height;
+	app.format = WL_SHM_FORMAT_ARGB8888;
 	app.on_key = on_key;
 	app.on_draw = on_draw;
 	app.running = 1;
 
+	damage_tracker_init(&app.damage_tracker, MAX_DAMAGE_RECTS);
+
 	globals.wl_display = wl_display_connect(NULL);
 	globals.wl_registry = wl_display_get_registry(globals.wl_display);
 	wl_registry_add_listener(globals.wl_registry, &registry_listener, NULL);
@@ -230,6 +593,10 @@ void app_init(int width, int height,
 
 	assert(globals.wl_shm && globals.wl_compositor && globals.wl_seat && globals.xdg_wm_base);
 
+	// Collect wl_shm.format events
+	wl_shm_add_listener(globals.wl_shm, &wl_shm_listener, NULL);
+	wl_display_roundtrip(globals.wl_display);
+
 	// Set up surface
 	surface.wl_surface = wl_compositor_create_surface(globals.wl_compositor);
 
@@ -249,51 +616,208 @@ void app_init(int width, int height,
 	struct wl_keyboard *wl_keyboard = wl_seat_get_keyboard(globals.wl_seat);
 	wl_keyboard_add_listener(wl_keyboard, &wl_keyboard_listener, NULL);
 
-	// Set up timer
-	timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	// Set up event loop
+	events.loop = event_loop_create();
+
+	events.wayland = event_loop_add_fd(events.loop, wl_display_get_fd(globals.wl_display),
+			EVENT_READABLE, on_wayland, NULL);
+	assert(events.wayland);
+	event_source_set_name(events.wayland, "wayland");
+
+	events.timers = timer_heap_create(events.loop);
+
+	// Leave through app_run() so the stats get printed. Blocked here, before
+	// the band pool or render thread exist, so those threads inherit the mask.
+	struct event_source *source;
+	if ((source = event_loop_add_signal(events.loop, SIGINT, on_signal, NULL)))
+		event_source_set_name(source, "sigint");
+	if ((source = event_loop_add_signal(events.loop, SIGTERM, on_signal, NULL)))
+		event_source_set_name(source, "sigterm");
+}
+
+static void request_frame()
+{
+	struct wl_surface *wl_surface = render.enabled ? render.wl_surface : surface.wl_surface;
+
+	struct wl_callback *frame_callback = wl_surface_frame(wl_surface);
+	wl_callback_add_listener(frame_callback, &frame_listener, NULL);
+	wl_surface_commit(surface.wl_surface);
+}
+
+static void on_render_wayland(int fd, uint32_t mask, void *data)
+{
+	render.read = 1;
+
+	// The main thread notices if the connection is gone
+	wl_display_read_events(globals.wl_display);
+}
+
+static void on_render_wake(int fd, uint32_t mask, void *data)
+{
+	uint64_t count;
+	read(fd, &count, sizeof(count));
+}
+
+static void *render_main(void *data)
+{
+	struct wl_display *wl_display = globals.wl_display;
+
+	for (;;) {
+		// Like the main thread, but reading into our own queue. Nothing slow
+		// may run between preparing and reading, the main thread can't read
+		// before we do.
+		while (wl_display_prepare_read_queue(wl_display, render.queue) != 0)
+			wl_display_dispatch_queue_pending(wl_display, render.queue);
+		wl_display_flush(wl_display);
+
+		render.read = 0;
+		event_loop_dispatch(render.loop, -1);
+		if (!render.read)
+			wl_display_cancel_read(wl_display);
+
+		// Frame callbacks draw from here
+		wl_display_dispatch_queue_pending(wl_display, render.queue);
+
+		pthread_mutex_lock(&render.lock);
+		int configure = render.configure;
+		int redraw = render.redraw;
+		int reclaim = render.reclaim;
+		int quit = render.quit;
+		render.configure = render.redraw = render.reclaim = 0;
+		pthread_mutex_unlock(&render.lock);
+
+		if (quit)
+			break;
+		if (reclaim)
+			buffers_reclaim();
+		if (configure)
+			frame(NULL, NULL, 0);
+		if (redraw)
+			request_frame();
+	}
+
+	return NULL;
+}
+
+void app_use_render_thread()
+{
+	render.enabled = 1;
+
+	render.queue = wl_display_create_queue(globals.wl_display);
+
+	render.wl_surface = wl_proxy_create_wrapper(surface.wl_surface);
+	wl_proxy_set_queue((struct wl_proxy *) render.wl_surface, render.queue);
+
+	render.wl_shm = wl_proxy_create_wrapper(globals.wl_shm);
+	wl_proxy_set_queue((struct wl_proxy *) render.wl_shm, render.queue);
+
+	render.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	render.loop = event_loop_create();
+
+	struct event_source *source = event_loop_add_fd(render.loop,
+			wl_display_get_fd(globals.wl_display), EVENT_READABLE, on_render_wayland, NULL);
+	assert(source);
+	event_source_set_name(source, "render-wayland");
+
+	source = event_loop_add_fd(render.loop, render.wake_fd, EVENT_READABLE,
+			on_render_wake, NULL);
+	assert(source);
+	event_source_set_name(source, "render-wake");
 }
 
 void app_run()
 {
-	enum {
-		WAYLAND,
-		TIMER,
-	};
-
-	struct pollfd pollfds[] = {
-		[WAYLAND] = {
-			.fd = wl_display_get_fd(globals.wl_display),
-			.events = POLLIN,
-		},
-		[TIMER] = {
-			.fd = timer.fd,
-			.events = POLLIN,
-		},
-	};
+	struct wl_display *wl_display = globals.wl_display;
+
+	if (render.enabled)
+		pthread_create(&render.thread, NULL, render_main, NULL);
 
 	while (app.running) {
-		wl_display_flush(globals.wl_display);
+		// Read through prepare/read rather than wl_display_dispatch(), which
+		// would block here if the render thread got to the data first
+		while (wl_display_prepare_read(wl_display) != 0)
+			wl_display_dispatch_pending(wl_display);
+		wl_display_flush(wl_display);
+
+		events.read = 0;
+		int ret = event_loop_dispatch(events.loop, -1);
+		if (!events.read)
+			wl_display_cancel_read(wl_display);
+		if (ret < 0)
+			break;
+
+		wl_display_dispatch_pending(wl_display);
+	}
 
-		poll(pollfds, sizeof(pollfds) / sizeof(pollfds[0]), -1);
+	if (render.enabled) {
+		render_post(&render.quit);
+		pthread_join(render.thread, NULL);
 
-		if (pollfds[WAYLAND].revents & POLLIN)
-			wl_display_dispatch(globals.wl_display);
+		event_loop_print_stats(render.loop, stderr);
+	}
+
+	damage_tracker_print_stats(&app.damage_tracker, stderr);
+	timer_heap_print_stats(events.timers, stderr);
+	event_loop_print_stats(events.loop, stderr);
+}
 
-		if (pollfds[TIMER].revents & POLLIN) {
-			uint64_t expirations;
-			read(pollfds[TIMER].fd, &expirations, sizeof(expirations));
+struct event_loop *app_get_event_loop()
+{
+	return events.loop;
+}
 
-			if (timer.on_timer)
-				timer.on_timer();
+void app_redraw()
+{
+	if (render.enabled)
+		render_post(&render.redraw);
+	else
+		request_frame();
+}
+
+int app_set_format(uint32_t format)
+{
+	if (pixel_size(format) == 0)
+		return -1;
+
+	for (int i = 0; i < globals.n_formats; i++) {
+		if (globals.formats[i] == format) {
+			pthread_mutex_lock(&render.lock);
+			app.format = format;
+			pthread_mutex_unlock(&render.lock);
+			return 0;
 		}
 	}
+
+	return -1;
 }
 
-void app_redraw()
+void app_damage(int x, int y, int width, int height)
 {
-	struct wl_callback *frame_callback = wl_surface_frame(surface.wl_surface);
-	wl_callback_add_listener(frame_callback, &frame_listener, NULL);
-	wl_surface_commit(surface.wl_surface);
+	pthread_mutex_lock(&render.lock);
+	damage_add(&app.damage, (struct rect){ x, y, width, height });
+	pthread_mutex_unlock(&render.lock);
+}
+
+void app_infer_damage(int enable)
+{
+	app.infer_damage = enable;
+
+	if (!enable)
+		frame_diff_finish(&app.diff);
+}
+
+void app_scroll(int dx)
+{
+	pthread_mutex_lock(&render.lock);
+	app.scroll_dx += dx;
+	app.scroll_x += dx;
+	pthread_mutex_unlock(&render.lock);
+}
+
+int app_get_scroll()
+{
+	return app.drawn_scroll_x;
 }
 
 void app_stop()
@@ -301,13 +825,15 @@ void app_stop()
 	app.running = 0;
 }
 
-void app_set_timer(int interval, void (*on_timer)())
+struct timer *app_add_timer(uint64_t interval_ns, void (*on_timer)(void *data), void *data)
 {
-	timer.on_timer = on_timer;
+	struct timer *timer = timer_heap_add(events.timers, on_timer, data);
+	timer_arm(timer, interval_ns, interval_ns);
+
+	return timer;
+}
 
-    struct itimerspec ts = {
-        .it_interval = { .tv_sec = interval, .tv_nsec = 0 },
-        .it_value    = { .tv_sec = interval, .tv_nsec = 0 },
-    };
-    timerfd_settime(timer.fd, 0, &ts, NULL);
+void app_remove_timer(struct timer *timer)
+{
+	timer_destroy(timer);
 }
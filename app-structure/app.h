@@ -2,16 +2,75 @@
 
 #include <stdint.h>
 
+#define MAX_DAMAGE_RECTS 8
+
+struct rect {
+	int x, y;
+	int width, height;
+};
+
+// Up to MAX_DAMAGE_RECTS disjoint rectangles, collapsed to their bounding box
+// on overflow
+struct damage {
+	struct rect rects[MAX_DAMAGE_RECTS];
+	int n;
+};
+
+// on_draw only needs to repaint the pixels covered by damage, the rest of the
+// buffer still holds what was drawn into it before. pixels are laid out as
+// format (see common/pixel.h), with no padding between rows. ARGB8888 is drawn
+// with straight alpha, the damaged part gets premultiplied afterwards.
 void app_init(int width, int height,
 		const char *title,
 		const char *app_id,
 		void (*on_key)(uint32_t key),
-		void (*on_draw)(uint32_t *pixels, int width, int height));
+		void (*on_draw)(void *pixels, int width, int height, uint32_t format,
+				const struct damage *damage));
+
+// Switch to a wl_shm format from PIXEL_FORMATS, e.g. RGB565 to halve the
+// bandwidth or XRGB8888 for opaque content. Returns -1 if the compositor
+// doesn't support it, ARGB8888 stays in use then.
+int app_set_format(uint32_t format);
+
+// Draw on a thread of its own, so a slow on_draw doesn't hold up input,
+// configures and timers. Call between app_init() and app_run(). on_draw then
+// runs on the render thread, everything else stays on the one calling
+// app_run(), which is where app_redraw(), app_damage() and app_scroll() are
+// meant to be called from.
+void app_use_render_thread();
 
 void app_run();
 
+// The loop app_run() waits in, for adding the app's own fds, timers and idle
+// work next to the Wayland connection. See common/loop.h.
+struct event_loop *app_get_event_loop();
+
 void app_redraw();
 
+// Mark part of the window as changed for the next redraw. Redrawing without any
+// damage repaints everything.
+void app_damage(int x, int y, int width, int height);
+
+// Work out damage by comparing each frame with the last one instead of
+// trusting app_damage(), for on_draw code that doesn't report it. Costs a
+// hash of the whole frame per redraw.
+void app_infer_damage(int enable);
+
+// The content moved dx pixels to the left (right if negative) since the last
+// frame. The next redraw moves the previous frame over and on_draw only gets
+// the uncovered columns as damage, plus whatever else was marked.
+void app_scroll(int dx);
+
+// Sum of every app_scroll() up to the frame on_draw is drawing. Taken along
+// with that frame's damage, so it matches the pixels scrolled into view even
+// when on_draw runs on the render thread. Call from on_draw only.
+int app_get_scroll();
+
 void app_stop();
 
-void app_set_timer(int interval, void (*on_timer)());
+// Calls on_timer every interval_ns, on schedule even if a tick runs late. Any
+// number of timers share one timerfd, see common/timers.h.
+struct timer *app_add_timer(uint64_t interval_ns, void (*on_timer)(void *data), void *data);
+
+// Safe to call from the timer's own on_timer
+void app_remove_timer(struct timer *timer);
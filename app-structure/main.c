@@ -1,10 +1,27 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "app.h"
+#include "atlas.h"
+#include "bands.h"
+#include "pixel.h"
+#include "timers.h"
+
+// Set with --threads N, NULL draws on the dispatch thread
+static struct band_pool *band_pool;
 
-static int offset = 0;
+// Set with --atlas, the pattern repeats every 256 pixels so it's drawn once
+// per format and copied from then on
+static int use_atlas;
+static struct atlas *atlas;
+static uint32_t atlas_format;
 
-static void on_timer()
+// Scrolls the content, set with keys 2-9 for a tick every 1-8 seconds
+static struct timer *scroll_timer;
+
+static void on_timer(void *data)
 {
-	offset += 100;
+	app_scroll(100);
 	app_redraw();
 }
 
@@ -13,20 +30,89 @@ static void on_key(uint32_t key)
 	if (key == 1)
 		app_stop();
 	else if (key < 10) {
-		app_set_timer(key - 1, on_timer);
+		if (scroll_timer)
+			app_remove_timer(scroll_timer);
+		scroll_timer = app_add_timer((key - 1) * NSEC_PER_SEC, on_timer, NULL);
 	}
 }
 
-static void on_draw(uint32_t *pixels, int width, int height)
+#define DRAW_KERNEL(name, wl_format, pixel_t) \
+	static void draw_##name(void *data, int width, const struct rect *rect, int ox) \
+	{ \
+		pixel_t *pixels = data; \
+		for (int y = rect->y; y < rect->y + rect->height; y++) { \
+			for (int x = rect->x; x < rect->x + rect->width; x++) { \
+				uint8_t r = (x + ox) ^ y; \
+				uint8_t g = (x + ox) ^ y; \
+				uint8_t b = (x + ox) ^ y; \
+				uint8_t a = 0x7f; \
+				pixels[y * width + x] = pack_##name(r, g, b, a); \
+			} \
+		} \
+	}
+
+#define ATLAS_KERNEL(name, wl_format, pixel_t) \
+	static void draw_period_##name(void *pixels, int size, void *data) \
+	{ \
+		struct rect period = { 0, 0, size, size }; \
+		draw_##name(pixels, size, &period, 0); \
+	}
+
+PIXEL_FORMATS(DRAW_KERNEL)
+PIXEL_FORMATS(ATLAS_KERNEL)
+
+static struct atlas *get_atlas(uint32_t format)
 {
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			uint8_t r = (x + offset) ^ y;
-			uint8_t g = (x + offset) ^ y;
-			uint8_t b = (x + offset) ^ y;
-			uint8_t a = 0x7f;
-			pixels[y * width + x] = (a << 24) + (r << 16) + (g << 8) + b;
-		}
+	if (atlas && atlas_format == format)
+		return atlas;
+
+	if (atlas)
+		atlas_destroy(atlas);
+
+	atlas = NULL;
+	atlas_format = format;
+
+#define X(name, wl_format, pixel_t) \
+	if (format == wl_format) \
+		atlas = atlas_create(sizeof(pixel_t), draw_period_##name, NULL);
+	PIXEL_FORMATS(X)
+#undef X
+
+	return atlas;
+}
+
+struct draw_job {
+	uint32_t format;
+	int offset;
+	const struct rect *rect;
+	const struct atlas *atlas;
+};
+
+// Draws the part of job->rect within rows [y0, y1)
+static void draw_band(void *pixels, int width, int y0, int y1, void *data)
+{
+	const struct draw_job *job = data;
+	struct rect band = { job->rect->x, y0, job->rect->width, y1 - y0 };
+
+	if (job->atlas)
+		atlas_fill(job->atlas, pixels, width * pixel_size(job->format),
+				band.x, band.y, band.width, band.height, job->offset, 0);
+	else
+		PIXEL_DISPATCH(job->format, draw, pixels, width, &band, job->offset);
+}
+
+static void on_draw(void *pixels, int width, int height, uint32_t format,
+		const struct damage *damage)
+{
+	const struct atlas *atlas = use_atlas ? get_atlas(format) : NULL;
+	int offset = app_get_scroll();
+
+	for (int i = 0; i < damage->n; i++) {
+		const struct rect *rect = &damage->rects[i];
+		struct draw_job job = { format, offset, rect, atlas };
+
+		band_pool_run(band_pool, pixels, width, rect->y, rect->y + rect->height,
+				draw_band, &job);
 	}
 }
 
@@ -34,7 +120,30 @@ int main(int argc, char *argv[])
 {
 	app_init(256, 256, "App demo", "learnwayland", on_key, on_draw);
 
+	for (int i = 1; i < argc; i++) {
+		// Opaque formats drop the alpha channel
+		if (strcmp(argv[i], "--rgb565") == 0)
+			app_set_format(WL_SHM_FORMAT_RGB565);
+		else if (strcmp(argv[i], "--opaque") == 0)
+			app_set_format(WL_SHM_FORMAT_XRGB8888);
+		// 0 for one thread per CPU
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			band_pool = band_pool_create(atoi(argv[++i]));
+		else if (strcmp(argv[i], "--atlas") == 0)
+			use_atlas = 1;
+		else if (strcmp(argv[i], "--diff") == 0)
+			app_infer_damage(1);
+		// on_draw runs on its own thread, keys stay responsive
+		else if (strcmp(argv[i], "--render-thread") == 0)
+			app_use_render_thread();
+	}
+
 	app_run();
 
+	if (band_pool)
+		band_pool_destroy(band_pool);
+	if (atlas)
+		atlas_destroy(atlas);
+
 	return 0;
 }
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <wayland-client.h>
 
+#include "../common/atlas.h"
 #include "../common/shm.h"
 #include "../protocols/xdg-shell.h"
 
@@ -19,6 +20,26 @@ static struct xdg_wm_base *xdg_wm_base = NULL;
 
 // --- drawing ---
 
+// Set with --atlas
+static struct atlas *atlas = NULL;
+
+static void draw_pattern(void *pixels, int width, int height)
+{
+	uint32_t *data = pixels;
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint8_t n = x ^ y;
+			data[y * width + x] = (n << 16) + (n << 8) + n;
+		}
+	}
+}
+
+static void draw_period(void *pixels, int size, void *data)
+{
+	draw_pattern(pixels, size, size);
+}
+
 static struct wl_buffer *draw_frame()
 {
 	const int width = 256, height = 256;
@@ -34,12 +55,11 @@ static struct wl_buffer *draw_frame()
 	wl_shm_pool_destroy(pool);
 	close(fd);
 
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			uint8_t n = x ^ y;
-			data[y * width + x] = (n << 16) + (n << 8) + n;
-		}
-	}
+	// The pattern repeats every 256 pixels, so the atlas only copies
+	if (atlas)
+		atlas_fill(atlas, data, stride, 0, 0, width, height, 0, 0);
+	else
+		draw_pattern(data, width, height);
 
 	munmap(data, size);
 
@@ -107,6 +127,9 @@ int main(int argc, char *argv[])
 	wl_registry_add_listener(registry, &registry_listener, NULL);
 	wl_display_roundtrip(display);
 
+	if (argc > 1 && strcmp(argv[1], "--atlas") == 0)
+		atlas = atlas_create(4, draw_period, NULL);
+
 	// Init state
 	struct app_state state = {
 		.surface = wl_compositor_create_surface(compositor),
@@ -122,5 +145,8 @@ int main(int argc, char *argv[])
 	while (wl_display_dispatch(display) != -1) {
 	}
 
+	if (atlas)
+		atlas_destroy(atlas);
+
 	return 0;
 }
@@ -0,0 +1,78 @@
+// Compares drawing the toplevel-events xor pattern pixel by pixel against
+// filling it from an atlas, at 1080p and 4K. Doesn't need a compositor.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "atlas.h"
+
+const int FRAMES = 100;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void draw(uint32_t *pixels, int width, int height, int offset)
+{
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint8_t n = (x + offset) ^ y;
+			pixels[y * width + x] = (n << 16) + (n << 8) + n;
+		}
+	}
+}
+
+static void draw_period(void *pixels, int size, void *data)
+{
+	draw(pixels, size, size, 0);
+}
+
+static void run(const struct atlas *atlas, int width, int height)
+{
+	size_t size = (size_t) width * height * 4;
+	uint32_t *expected = malloc(size);
+	uint32_t *pixels = malloc(size);
+
+	// Touch everything before timing
+	memset(expected, 0, size);
+	memset(pixels, 0, size);
+
+	double start = now();
+	for (int frame = 0; frame < FRAMES; frame++)
+		draw(expected, width, height, frame);
+	double direct = (now() - start) / FRAMES;
+
+	start = now();
+	for (int frame = 0; frame < FRAMES; frame++)
+		atlas_fill(atlas, pixels, width * 4, 0, 0, width, height, frame, 0);
+	double filled = (now() - start) / FRAMES;
+
+	// Both hold the last frame now
+	int identical = memcmp(expected, pixels, size) == 0;
+
+	printf("%dx%d: direct %.2f ms, atlas %.2f ms (%.1f GB/s), %.1fx  %s\n",
+			width, height, direct * 1e3, filled * 1e3, size / filled / 1e9,
+			direct / filled, identical ? "matches" : "MISMATCH");
+
+	free(expected);
+	free(pixels);
+}
+
+int main(int argc, char *argv[])
+{
+	struct atlas *atlas = atlas_create(4, draw_period, NULL);
+
+	run(atlas, 1920, 1080);
+	run(atlas, 3840, 2160);
+
+	atlas_destroy(atlas);
+
+	return 0;
+}
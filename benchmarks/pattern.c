@@ -0,0 +1,58 @@
+// Checks every xor pattern kernel against the scalar reference and reports
+// its throughput. Doesn't need a compositor.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pattern.h"
+
+const int WIDTH = 512;
+const int HEIGHT = 512;
+const int FRAMES = 2000;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct pattern_kernel *kernels;
+	int n = pattern_kernels(&kernels);
+
+	// Odd width exercises the scalar tails
+	const int check_width = WIDTH + 3;
+	uint32_t *expected = malloc(check_width * HEIGHT * 4);
+	uint32_t *pixels = malloc(check_width * HEIGHT * 4);
+
+	printf("%dx%d, %d frames\n", WIDTH, HEIGHT, FRAMES);
+
+	for (int i = 0; i < n; i++) {
+		int identical = 1;
+		for (uint32_t time = 0; time < 100000; time += 4999) {
+			kernels[0].fill(expected, check_width, HEIGHT, time);
+			kernels[i].fill(pixels, check_width, HEIGHT, time);
+			identical &= memcmp(expected, pixels, check_width * HEIGHT * 4) == 0;
+		}
+
+		double start = now();
+		for (int frame = 0; frame < FRAMES; frame++)
+			kernels[i].fill(pixels, WIDTH, HEIGHT, frame * 16);
+		double elapsed = now() - start;
+
+		printf("%-8s %8.1f Mpx/s  %s\n", kernels[i].name,
+				(double) WIDTH * HEIGHT * FRAMES / elapsed / 1e6,
+				identical ? "matches scalar" : "MISMATCH");
+	}
+
+	free(expected);
+	free(pixels);
+
+	return 0;
+}
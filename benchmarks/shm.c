@@ -0,0 +1,92 @@
+// Compares page faults and fill throughput of a 4K XRGB buffer for each
+// allocate_shm_file_flags() mode, and with the buffer prefaulted.
+// Doesn't need a compositor.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+const int WIDTH = 3840;
+const int HEIGHT = 2160;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long minor_faults()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_minflt;
+}
+
+static void fill(uint32_t *pixels, uint32_t seed)
+{
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			uint8_t n = (x + seed) ^ y;
+			pixels[y * WIDTH + x] = (n << 16) + (n << 8) + n;
+		}
+	}
+}
+
+static void run(const char *name, int flags)
+{
+	const size_t size = WIDTH * HEIGHT * 4;
+	const double mib = size / (1024. * 1024.);
+
+	int requested = flags;
+	double start = now();
+	int fd = allocate_shm_file_flags(size, &flags);
+	uint32_t *pixels = fd < 0 ? MAP_FAILED : map_shm_file(fd, size, flags);
+	if (pixels == MAP_FAILED) {
+		if (fd >= 0)
+			close(fd);
+		printf("%-8s allocation failed\n", name);
+		return;
+	}
+	double alloc = now() - start;
+
+	// First frame pays for faulting the buffer in
+	long faults = minor_faults();
+	start = now();
+	fill(pixels, 0);
+	double first = now() - start;
+	faults = minor_faults() - faults;
+
+	// Steady state, everything already mapped
+	start = now();
+	for (int i = 1; i <= 10; i++)
+		fill(pixels, i);
+	double steady = (now() - start) / 10;
+
+	printf("%-8s %s alloc %6.2f ms  %6ld faults  first %6.2f ms (%5.0f MiB/s)  "
+			"steady %6.2f ms (%5.0f MiB/s)\n",
+			name, (flags & ~SHM_THP) == (requested & ~SHM_THP) ? "  " : "->",
+			alloc * 1e3, faults, first * 1e3, mib / first, steady * 1e3, mib / steady);
+
+	unmap_shm_file(pixels, size, flags);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	printf("%dx%d XRGB8888 (\"->\" = fell back to THP)\n", WIDTH, HEIGHT);
+
+	run("4k", 0);
+	run("thp", SHM_THP);
+	run("hugetlb", SHM_HUGETLB);
+	run("populate", SHM_POPULATE);
+
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
@@ -14,10 +15,32 @@
 #include "../protocols/xdg-decoration-unstable-v1.h"
 #include "../protocols/xdg-shell.h"
 
-struct buffer {
-	struct wl_buffer *wl_buffer;
-	uint32_t *pixels;
-	int size;
+#include "cache.h"
+#include "log.h"
+#include "shm.h"
+#include "tiles.h"
+
+// Released buffers kept around for reuse
+const size_t BUFFER_CACHE_MAX_BYTES = 64 * 1024 * 1024;
+
+// Text that never changes, shaped once
+struct text {
+	const char *string;
+	cairo_text_extents_t extents;
+	cairo_glyph_t *glyphs;
+	int n_glyphs;
+};
+
+// Cairo objects that live as long as their buffer, in cached_buffer->data
+struct cairo_buffer {
+	cairo_t *cr;
+
+	// One surface and context per tile when drawing with a tile pool. Each
+	// tile has its own image surface over the buffer memory, so threads never
+	// share cairo objects.
+	cairo_t **tiles;
+	int cols;
+	int rows;
 };
 
 struct app_state {
@@ -43,6 +66,17 @@ struct app_state {
 	// App state
 	bool running;
 
+	// SHM_* flags for new buffers
+	int shm_flags;
+	struct buffer_cache buffer_cache;
+
+	// Set with --threads N, NULL draws on the dispatch thread
+	struct tile_pool *tile_pool;
+	bool print_heatmap;
+
+	cairo_scaled_font_t *font;
+	struct text hello;
+
 	int width;
 	int height;
 };
@@ -92,67 +126,112 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = noop,
 };
 
-static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+static cairo_t *create_context(void *pixels, int width, int height, int stride,
+		cairo_scaled_font_t *font)
 {
-	struct buffer *buffer = data;
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(pixels,
+			CAIRO_FORMAT_ARGB32, width, height, stride);
+	cairo_t *cr = cairo_create(surface);
+	cairo_set_scaled_font(cr, font);
 
-	wl_buffer_destroy(buffer->wl_buffer);
-	munmap(buffer->pixels, buffer->size);
-	free(buffer);
-}
+	// The context holds a reference
+	cairo_surface_destroy(surface);
 
-static const struct wl_buffer_listener wl_buffer_listener = {
-	.release = wl_buffer_release,
-};
+	return cr;
+}
 
-struct buffer *create_buffer(struct app_state *app, int width, int height)
+static void buffer_destroy(struct cached_buffer *buffer)
 {
-	int size = width * height * 4;
-	int stride = width * 4;
+	struct cairo_buffer *cb = buffer->data;
 
-	int fd = memfd_create("buffer-pool", 0);
-	ftruncate(fd, size);
+	for (int i = 0; cb->tiles && i < cb->cols * cb->rows; i++) {
+		if (cb->tiles[i])
+			cairo_destroy(cb->tiles[i]);
+	}
 
-	struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(app->wl_shm, fd, size);
+	free(cb->tiles);
+	cairo_destroy(cb->cr);
+	free(cb);
+}
 
-	struct buffer *buffer = calloc(1, sizeof(*buffer));
-	buffer->size = size;
-	buffer->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	buffer->wl_buffer = wl_shm_pool_create_buffer(wl_shm_pool, 0, width, height,
-			stride, WL_SHM_FORMAT_ARGB8888);
-	wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+static struct cached_buffer *get_buffer(struct app_state *app, int width, int height)
+{
+	struct cached_buffer *buffer = buffer_cache_get(&app->buffer_cache, width,
+			height, WL_SHM_FORMAT_ARGB8888);
+	if (!buffer)
+		return NULL;
+
+	// The cairo objects are recycled along with the buffer
+	if (!buffer->data) {
+		struct cairo_buffer *cb = calloc(1, sizeof(*cb));
+		cb->cr = create_context(buffer->pixels, width, height, buffer->stride, app->font);
+		buffer->data = cb;
+	}
 
-	wl_shm_pool_destroy(wl_shm_pool);
-	close(fd);
+	struct cairo_buffer *cb = buffer->data;
+	if (app->tile_pool && !cb->tiles) {
+		cb->cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+		cb->rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+		cb->tiles = calloc(cb->cols * cb->rows, sizeof(*cb->tiles));
+	}
 
 	return buffer;
 }
 
-static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
-		uint32_t serial)
+static void text_init(struct text *text, cairo_scaled_font_t *font, const char *string)
 {
-	struct app_state *app = data;
+	text->string = string;
+	cairo_scaled_font_text_extents(font, string, &text->extents);
+	cairo_scaled_font_text_to_glyphs(font, 0, 0, string, -1, &text->glyphs,
+			&text->n_glyphs, NULL, NULL, NULL);
+}
 
-	xdg_surface_ack_configure(xdg_surface, serial);
+static void text_finish(struct text *text)
+{
+	cairo_glyph_free(text->glyphs);
+}
 
-	struct buffer *buffer = create_buffer(app, app->width, app->height);
+struct draw_job {
+	struct app_state *app;
+	struct cached_buffer *buffer;
+};
+
+// Draws the part of the frame at x, y, width x height. Without a tile pool
+// that's the whole frame.
+static void draw_tile(int x, int y, int width, int height, void *data)
+{
+	struct draw_job *job = data;
+	struct app_state *app = job->app;
+	struct cairo_buffer *cb = job->buffer->data;
+	uint32_t *pixels = job->buffer->pixels;
 
 	// Fill xor pattern by hand
-	for (int y = 0; y < app->height; y++) {
-		for (int x = 0; x < app->width; x++) {
-			uint8_t r = x ^ y;
-			uint8_t g = x ^ y;
-			uint8_t b = x ^ y;
+	for (int j = y; j < y + height; j++) {
+		for (int i = x; i < x + width; i++) {
+			uint8_t r = i ^ j;
+			uint8_t g = i ^ j;
+			uint8_t b = i ^ j;
 			uint8_t a = 0xff;
-			buffer->pixels[y * app->width + x] = (a << 24) + (r << 16) +
+			pixels[j * app->width + i] = (a << 24) + (r << 16) +
 												 (g << 8) + b;
 		}
 	}
 
-	cairo_surface_t *surface = cairo_image_surface_create_for_data(
-			(uint8_t *) buffer->pixels, CAIRO_FORMAT_ARGB32, app->width, app->height,
-			app->width * 4);
-	cairo_t *cr = cairo_create(surface);
+	// Without tiles this is the whole frame. Otherwise it's a surface over
+	// just this tile, cairo clips everything outside of it.
+	cairo_t *cr = cb->cr;
+	if (cb->tiles) {
+		cairo_t **tile = &cb->tiles[y / TILE_SIZE * cb->cols + x / TILE_SIZE];
+		if (!*tile)
+			*tile = create_context(pixels + y * app->width + x, width, height,
+					app->width * 4, app->font);
+		cr = *tile;
+	}
+
+	cairo_surface_mark_dirty(cairo_get_target(cr));
+
+	cairo_save(cr);
+	cairo_translate(cr, -x, -y);
 
 	cairo_save(cr);
 	cairo_translate(cr, app->width / 2., app->height / 2.);
@@ -171,18 +250,48 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 	cairo_set_source_rgba(cr, 0, 0, 1, 0.80);
 	cairo_stroke(cr);
 
-	// Show text
-	const char *text = "Hello";
+	// Show text, shaped at the origin when the font was loaded
+	const struct text *text = &app->hello;
 	cairo_set_source_rgba(cr, 1, 1, 1, 1);
-	cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, 40);
-	cairo_text_extents_t ext;
-	cairo_text_extents(cr, text, &ext);
-	cairo_move_to(cr, (app->width - ext.width) / 2., (app->height + ext.height) / 2.);
-	cairo_show_text(cr, text);
+	cairo_translate(cr, (app->width - text->extents.width) / 2.,
+			(app->height + text->extents.height) / 2.);
+	cairo_show_glyphs(cr, text->glyphs, text->n_glyphs);
 
-	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
+	cairo_restore(cr);
+	cairo_surface_flush(cairo_get_target(cr));
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+		uint32_t serial)
+{
+	struct app_state *app = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+
+	struct cached_buffer *buffer = get_buffer(app, app->width, app->height);
+	if (!buffer) {
+		LOG("No buffer for %dx%d, skipping frame", app->width, app->height);
+		return;
+	}
+
+	LOG("Buffer cache: %d hits, %d misses, %d evictions", app->buffer_cache.hits,
+			app->buffer_cache.misses, app->buffer_cache.evictions);
+
+	// Faults taken while drawing, --prefault moves them into buffer_cache_get()
+	struct rusage usage_start;
+	getrusage(RUSAGE_SELF, &usage_start);
+
+	struct draw_job job = { app, buffer };
+	tile_pool_run(app->tile_pool, app->width, app->height, draw_tile, &job);
+
+	if (app->tile_pool && app->print_heatmap)
+		tile_pool_print_heatmap(app->tile_pool, stderr);
+
+	struct rusage usage_end;
+	getrusage(RUSAGE_SELF, &usage_end);
+	LOG("Draw: %ld minor, %ld major faults",
+			usage_end.ru_minflt - usage_start.ru_minflt,
+			usage_end.ru_majflt - usage_start.ru_majflt);
 
 	wl_surface_attach(app->wl_surface, buffer->wl_buffer, 0, 0);
 	wl_surface_commit(app->wl_surface);
@@ -227,6 +336,23 @@ void app_init(struct app_state *app)
 			app->wp_viewporter && app->wp_single_pixel_buffer_manager_v1 &&
 			app->zxdg_decoration_manager_v1);
 
+	buffer_cache_init(&app->buffer_cache, app->wl_shm, BUFFER_CACHE_MAX_BYTES,
+			buffer_destroy);
+
+	// Font lookup and shaping happen once, not per frame
+	cairo_font_face_t *face = cairo_toy_font_face_create("sans-serif",
+			CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_matrix_t font_matrix, ctm;
+	cairo_matrix_init_scale(&font_matrix, 40, 40);
+	cairo_matrix_init_identity(&ctm);
+	cairo_font_options_t *options = cairo_font_options_create();
+	app->font = cairo_scaled_font_create(face, &font_matrix, &ctm, options);
+	cairo_font_options_destroy(options);
+	cairo_font_face_destroy(face);
+
+	text_init(&app->hello, app->font, "Hello");
+	app->buffer_cache.shm_flags = app->shm_flags;
+
 	// Set up surface
 	app->wl_surface = wl_compositor_create_surface(app->wl_compositor);
 
@@ -259,11 +385,34 @@ int main(int argc, char *argv[])
 		.height = 256,
 	};
 
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--prefault") == 0)
+			app.shm_flags |= SHM_POPULATE;
+		else if (strcmp(argv[i], "--mlock") == 0)
+			app.shm_flags |= SHM_LOCK;
+		// 0 for one thread per CPU
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			app.tile_pool = tile_pool_create(atoi(argv[++i]));
+		else if (strcmp(argv[i], "--heatmap") == 0)
+			app.print_heatmap = true;
+	}
+
 	app_init(&app);
 
 	// Main loop
 	while (wl_display_dispatch(app.wl_display) != -1 && app.running) {
 	}
 
+	fprintf(stderr, "Buffer cache: %d hits, %d misses, %d evictions\n",
+			app.buffer_cache.hits, app.buffer_cache.misses,
+			app.buffer_cache.evictions);
+
+	if (app.tile_pool)
+		tile_pool_destroy(app.tile_pool);
+
+	buffer_cache_finish(&app.buffer_cache);
+	text_finish(&app.hello);
+	cairo_scaled_font_destroy(app.font);
+
 	return 0;
 }
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+
+struct atlas {
+	int bpp;
+
+	// Every row holds two periods, so a run of up to ATLAS_PERIOD pixels
+	// starting anywhere in the first one is contiguous
+	uint8_t *pixels;
+	int stride;
+};
+
+struct atlas *atlas_create(int bytes_per_pixel, atlas_draw draw, void *data)
+{
+	const int period_stride = ATLAS_PERIOD * bytes_per_pixel;
+
+	uint8_t *period = malloc(period_stride * ATLAS_PERIOD);
+	if (!period)
+		return NULL;
+
+	struct atlas *atlas = calloc(1, sizeof(*atlas));
+	if (!atlas)
+		goto err;
+
+	atlas->bpp = bytes_per_pixel;
+	atlas->stride = 2 * period_stride;
+	atlas->pixels = malloc(atlas->stride * ATLAS_PERIOD);
+	if (!atlas->pixels)
+		goto err_atlas;
+
+	draw(period, ATLAS_PERIOD, data);
+
+	for (int y = 0; y < ATLAS_PERIOD; y++) {
+		uint8_t *row = atlas->pixels + y * atlas->stride;
+		memcpy(row, period + y * period_stride, period_stride);
+		memcpy(row + period_stride, period + y * period_stride, period_stride);
+	}
+
+	free(period);
+
+	return atlas;
+
+err_atlas:
+	free(atlas);
+err:
+	free(period);
+	return NULL;
+}
+
+void atlas_destroy(struct atlas *atlas)
+{
+	free(atlas->pixels);
+	free(atlas);
+}
+
+void atlas_fill(const struct atlas *atlas, void *pixels, int stride,
+		int x, int y, int width, int height, int ox, int oy)
+{
+	const int bpp = atlas->bpp;
+	const int sx = (x + ox) & (ATLAS_PERIOD - 1);
+	const int run = (width < ATLAS_PERIOD ? width : ATLAS_PERIOD) * bpp;
+
+	for (int j = y; j < y + height; j++) {
+		const uint8_t *src = atlas->pixels +
+				((j + oy) & (ATLAS_PERIOD - 1)) * atlas->stride + sx * bpp;
+		uint8_t *dst = (uint8_t *) pixels + j * stride + x * bpp;
+
+		// The pattern repeats after a period, so every run is the same copy
+		int left = width * bpp;
+		while (left >= run) {
+			memcpy(dst, src, run);
+			dst += run;
+			left -= run;
+		}
+		memcpy(dst, src, left);
+	}
+}
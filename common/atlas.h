@@ -0,0 +1,26 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+/*
+ * Patterns that repeat every ATLAS_PERIOD pixels in x and y, like anything
+ * computed in uint8_t from the coordinates, only need drawing once. The atlas
+ * keeps one period and fills frames from it with memcpy.
+ */
+
+#define ATLAS_PERIOD 256
+
+struct atlas;
+
+// Draws one ATLAS_PERIOD x ATLAS_PERIOD period with no padding between rows
+typedef void (*atlas_draw)(void *pixels, int size, void *data);
+
+// NULL if out of memory, draw directly then
+struct atlas *atlas_create(int bytes_per_pixel, atlas_draw draw, void *data);
+void atlas_destroy(struct atlas *atlas);
+
+// Fills x, y, width x height of a buffer stride bytes wide with the pattern
+// shifted by ox, oy, i.e. pixel (x, y) gets the pattern's (x + ox, y + oy)
+void atlas_fill(const struct atlas *atlas, void *pixels, int stride,
+		int x, int y, int width, int height, int ox, int oy);
+
+#endif
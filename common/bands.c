@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bands.h"
+#include "log.h"
+
+// Bands handed out per thread, so a slow band doesn't hold up the frame
+#define BANDS_PER_THREAD 4
+
+// Fewer rows than this aren't worth waking a thread for
+#define MIN_BAND_HEIGHT 8
+
+struct band_pool {
+	pthread_t *workers;
+	int n_workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	// Current job, only changed while no band of it is in flight
+	band_kernel kernel;
+	void *pixels;
+	int width;
+	int y0, y1;
+	int band_height;
+	void *data;
+
+	int bands;
+	int next;
+	int finished;
+
+	unsigned int generation;
+	int quit;
+};
+
+// Called with the lock held, returns with it held
+static void run_bands(struct band_pool *pool)
+{
+	while (pool->next < pool->bands) {
+		int band = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+
+		int y0 = pool->y0 + band * pool->band_height;
+		int y1 = y0 + pool->band_height;
+		if (y1 > pool->y1)
+			y1 = pool->y1;
+		pool->kernel(pool->pixels, pool->width, y0, y1, pool->data);
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->finished == pool->bands)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+static void *worker(void *data)
+{
+	struct band_pool *pool = data;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (pool->generation == generation && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		run_bands(pool);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct band_pool *band_pool_create(int threads)
+{
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+
+	struct band_pool *pool = calloc(1, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->workers = calloc(threads - 1, sizeof(*pool->workers));
+	for (int i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->workers[i], NULL, worker, pool) != 0) {
+			LOG("Failed to start worker %d", i);
+			break;
+		}
+		pool->n_workers++;
+	}
+
+	LOG("Band pool with %d threads", pool->n_workers + 1);
+
+	return pool;
+}
+
+void band_pool_destroy(struct band_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->n_workers; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->workers);
+	free(pool);
+}
+
+void band_pool_run(struct band_pool *pool, void *pixels, int width, int y0, int y1,
+		band_kernel kernel, void *data)
+{
+	int rows = y1 - y0;
+	if (rows <= 0)
+		return;
+
+	if (!pool || pool->n_workers == 0 || rows < 2 * MIN_BAND_HEIGHT) {
+		kernel(pixels, width, y0, y1, data);
+		return;
+	}
+
+	int threads = pool->n_workers + 1;
+	int band_height = (rows + threads * BANDS_PER_THREAD - 1) / (threads * BANDS_PER_THREAD);
+	if (band_height < MIN_BAND_HEIGHT)
+		band_height = MIN_BAND_HEIGHT;
+
+	pthread_mutex_lock(&pool->lock);
+
+	pool->kernel = kernel;
+	pool->pixels = pixels;
+	pool->width = width;
+	pool->y0 = y0;
+	pool->y1 = y1;
+	pool->band_height = band_height;
+	pool->data = data;
+	pool->bands = (rows + band_height - 1) / band_height;
+	pool->next = 0;
+	pool->finished = 0;
+
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	// Draw along instead of just waiting
+	run_bands(pool);
+
+	while (pool->finished < pool->bands)
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int band_pool_threads(struct band_pool *pool)
+{
+	return pool ? pool->n_workers + 1 : 1;
+}
@@ -0,0 +1,29 @@
+#ifndef BANDS_H
+#define BANDS_H
+
+/*
+ * Parallel drawing in horizontal bands.
+ *
+ * A band pool keeps its worker threads around between frames. band_pool_run()
+ * splits a range of rows into bands, hands them out to the workers and the
+ * calling thread, and returns once every band is drawn, so the buffer can be
+ * attached right after.
+ */
+
+// Draws rows [y0, y1) of a buffer width pixels wide
+typedef void (*band_kernel)(void *pixels, int width, int y0, int y1, void *data);
+
+struct band_pool;
+
+// Draws with threads threads in total, including the caller. 0 for one per CPU.
+struct band_pool *band_pool_create(int threads);
+void band_pool_destroy(struct band_pool *pool);
+
+// Runs kernel over rows [y0, y1) and waits for it to finish. A NULL pool runs
+// it on the calling thread in one go.
+void band_pool_run(struct band_pool *pool, void *pixels, int width, int y0, int y1,
+		band_kernel kernel, void *data);
+
+int band_pool_threads(struct band_pool *pool);
+
+#endif
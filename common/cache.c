@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "cache.h"
+#include "pixel.h"
+#include "shm.h"
+
+static void buffer_destroy(struct cached_buffer *buffer)
+{
+	struct buffer_cache *cache = buffer->cache;
+
+	if (cache->on_destroy)
+		cache->on_destroy(buffer);
+
+	if (buffer->owned_prev)
+		buffer->owned_prev->owned_next = buffer->owned_next;
+	else
+		cache->owned = buffer->owned_next;
+	if (buffer->owned_next)
+		buffer->owned_next->owned_prev = buffer->owned_prev;
+
+	wl_buffer_destroy(buffer->wl_buffer);
+	unmap_shm_file(buffer->pixels, buffer->size, buffer->shm_flags);
+	free(buffer);
+}
+
+static void evict(struct buffer_cache *cache)
+{
+	// Drop from the least recently used end
+	while (cache->free_bytes > cache->max_bytes) {
+		struct cached_buffer **link = &cache->free;
+		while ((*link)->next)
+			link = &(*link)->next;
+
+		struct cached_buffer *buffer = *link;
+		*link = NULL;
+		cache->free_bytes -= buffer->size;
+		cache->evictions++;
+
+		buffer_destroy(buffer);
+	}
+}
+
+static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct cached_buffer *buffer = data;
+	struct buffer_cache *cache = buffer->cache;
+
+	buffer->next = cache->free;
+	cache->free = buffer;
+	cache->free_bytes += buffer->size;
+
+	evict(cache);
+}
+
+static const struct wl_buffer_listener wl_buffer_listener = {
+	.release = wl_buffer_release,
+};
+
+void buffer_cache_init(struct buffer_cache *cache, struct wl_shm *wl_shm,
+		size_t max_bytes, void (*on_destroy)(struct cached_buffer *buffer))
+{
+	*cache = (struct buffer_cache){
+		.wl_shm = wl_shm,
+		.max_bytes = max_bytes,
+		.on_destroy = on_destroy,
+	};
+}
+
+void buffer_cache_finish(struct buffer_cache *cache)
+{
+	cache->max_bytes = 0;
+	evict(cache);
+
+	// Whatever is left is still with the compositor, we're going away anyway
+	while (cache->owned)
+		buffer_destroy(cache->owned);
+}
+
+struct cached_buffer *buffer_cache_get(struct buffer_cache *cache,
+		int width, int height, uint32_t format)
+{
+	for (struct cached_buffer **link = &cache->free; *link; link = &(*link)->next) {
+		struct cached_buffer *buffer = *link;
+		if (buffer->width == width && buffer->height == height &&
+				buffer->format == format) {
+			*link = buffer->next;
+			buffer->next = NULL;
+			cache->free_bytes -= buffer->size;
+			cache->hits++;
+
+			return buffer;
+		}
+	}
+
+	cache->misses++;
+
+	int stride = width * pixel_size(format);
+	int size = stride * height;
+
+	int flags = cache->shm_flags;
+	int fd = allocate_shm_file_flags(size, &flags);
+	if (fd < 0)
+		return NULL;
+
+	struct cached_buffer *buffer = calloc(1, sizeof(*buffer));
+	buffer->cache = cache;
+	buffer->pixels = map_shm_file(fd, size, flags);
+	if (buffer->pixels == MAP_FAILED) {
+		free(buffer);
+		close(fd);
+		return NULL;
+	}
+	buffer->size = size;
+	buffer->shm_flags = flags;
+	buffer->width = width;
+	buffer->height = height;
+	buffer->stride = stride;
+	buffer->format = format;
+
+	struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(cache->wl_shm, fd, size);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(wl_shm_pool, 0, width, height,
+			stride, format);
+	wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+	wl_shm_pool_destroy(wl_shm_pool);
+	close(fd);
+
+	buffer->owned_next = cache->owned;
+	if (cache->owned)
+		cache->owned->owned_prev = buffer;
+	cache->owned = buffer;
+
+	return buffer;
+}
@@ -0,0 +1,68 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Recycles wl_shm buffers keyed by (width, height, format).
+ *
+ * Buffers handed out by buffer_cache_get() return to the cache by themselves
+ * when the compositor releases them. Released buffers are kept, most recently
+ * used first, until they exceed max_bytes, then the oldest are destroyed.
+ */
+
+struct cached_buffer {
+	struct buffer_cache *cache;
+	struct wl_buffer *wl_buffer;
+
+	void *pixels;
+	size_t size;
+
+	int width;
+	int height;
+	int stride;
+	uint32_t format;
+
+	// SHM_* flags that took effect, the mapping may be rounded up for them
+	int shm_flags;
+
+	// Owned by the caller and kept across reuse, e.g. a pixman_image_t.
+	// Freed through the cache's on_destroy.
+	void *data;
+
+	struct cached_buffer *next;
+
+	// Every buffer the cache owns, free or held by the compositor
+	struct cached_buffer *owned_prev, *owned_next;
+};
+
+struct buffer_cache {
+	struct wl_shm *wl_shm;
+	int shm_flags;
+
+	struct cached_buffer *owned;
+
+	// Released buffers, most recently used first
+	struct cached_buffer *free;
+	size_t free_bytes;
+	size_t max_bytes;
+
+	void (*on_destroy)(struct cached_buffer *buffer);
+
+	int hits;
+	int misses;
+	int evictions;
+};
+
+void buffer_cache_init(struct buffer_cache *cache, struct wl_shm *wl_shm,
+		size_t max_bytes, void (*on_destroy)(struct cached_buffer *buffer));
+// Destroys every buffer, including ones the compositor still holds
+void buffer_cache_finish(struct buffer_cache *cache);
+
+// NULL if the buffer couldn't be allocated
+
+struct cached_buffer *buffer_cache_get(struct buffer_cache *cache,
+		int width, int height, uint32_t format);
+
+#endif
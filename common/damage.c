@@ -0,0 +1,100 @@
+#include <wayland-client.h>
+
+#include "damage.h"
+#include "log.h"
+
+void damage_tracker_init(struct damage_tracker *tracker, int max_rects)
+{
+	*tracker = (struct damage_tracker){ .max_rects = max_rects > 0 ? max_rects : 1 };
+	pixman_region32_init(&tracker->region);
+}
+
+void damage_tracker_finish(struct damage_tracker *tracker)
+{
+	pixman_region32_fini(&tracker->region);
+}
+
+void damage_tracker_add(struct damage_tracker *tracker, int x, int y, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return;
+
+	pixman_region32_union_rect(&tracker->region, &tracker->region, x, y, width, height);
+}
+
+int damage_tracker_empty(struct damage_tracker *tracker)
+{
+	return !pixman_region32_not_empty(&tracker->region);
+}
+
+static uint64_t region_area(pixman_region32_t *region)
+{
+	int n;
+	pixman_box32_t *boxes = pixman_region32_rectangles(region, &n);
+
+	uint64_t area = 0;
+	for (int i = 0; i < n; i++)
+		area += (uint64_t) (boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1);
+
+	return area;
+}
+
+void damage_tracker_submit(struct damage_tracker *tracker, struct wl_surface *surface,
+		int width, int height)
+{
+	pixman_region32_intersect_rect(&tracker->region, &tracker->region, 0, 0, width, height);
+
+	int n;
+	pixman_box32_t *boxes = pixman_region32_rectangles(&tracker->region, &n);
+
+	// Boxes come sorted top to bottom, left to right, so runs of them are
+	// close together. Split them into max_rects runs and send each one's
+	// bounding box.
+	int groups = n < tracker->max_rects ? n : tracker->max_rects;
+
+	pixman_region32_t submitted;
+	pixman_region32_init(&submitted);
+
+	for (int g = 0; g < groups; g++) {
+		int first = n * g / groups;
+		int last = n * (g + 1) / groups;
+
+		pixman_box32_t box = boxes[first];
+		for (int i = first + 1; i < last; i++) {
+			if (boxes[i].x1 < box.x1) box.x1 = boxes[i].x1;
+			if (boxes[i].y1 < box.y1) box.y1 = boxes[i].y1;
+			if (boxes[i].x2 > box.x2) box.x2 = boxes[i].x2;
+			if (boxes[i].y2 > box.y2) box.y2 = boxes[i].y2;
+		}
+
+		wl_surface_damage_buffer(surface, box.x1, box.y1,
+				box.x2 - box.x1, box.y2 - box.y1);
+		pixman_region32_union_rect(&submitted, &submitted, box.x1, box.y1,
+				box.x2 - box.x1, box.y2 - box.y1);
+	}
+
+	tracker->frame_damaged = region_area(&submitted);
+	tracker->frame_total = (uint64_t) width * height;
+	tracker->frame_rects = groups;
+
+	tracker->frames++;
+	tracker->damaged += tracker->frame_damaged;
+	tracker->total += tracker->frame_total;
+
+	LOG("Damage: %d of %d rects, %lu of %lu pixels", groups, n,
+			(unsigned long) tracker->frame_damaged,
+			(unsigned long) tracker->frame_total);
+
+	pixman_region32_fini(&submitted);
+	pixman_region32_clear(&tracker->region);
+}
+
+void damage_tracker_print_stats(struct damage_tracker *tracker, FILE *out)
+{
+	fprintf(out, "damage: %d frames, %.1f%% of pixels damaged, "
+			"%.0f of %.0f per frame\n",
+			tracker->frames,
+			tracker->total ? 100.0 * tracker->damaged / tracker->total : 0.0,
+			tracker->frames ? (double) tracker->damaged / tracker->frames : 0.0,
+			tracker->frames ? (double) tracker->total / tracker->frames : 0.0);
+}
@@ -0,0 +1,47 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pixman.h>
+
+/*
+ * Surface damage collected as a pixman region.
+ *
+ * Rectangles added during a frame are merged by the region, clipped to the
+ * buffer on submit, and sent with at most max_rects wl_surface_damage_buffer
+ * requests. Past that, neighbouring rectangles are sent as their bounding box.
+ */
+
+struct wl_surface;
+
+struct damage_tracker {
+	pixman_region32_t region;
+	int max_rects;
+
+	// Last submitted frame
+	uint64_t frame_damaged;
+	uint64_t frame_total;
+	int frame_rects;
+
+	// Counters since init
+	int frames;
+	uint64_t damaged;
+	uint64_t total;
+};
+
+void damage_tracker_init(struct damage_tracker *tracker, int max_rects);
+void damage_tracker_finish(struct damage_tracker *tracker);
+
+// Buffer coordinates
+void damage_tracker_add(struct damage_tracker *tracker, int x, int y, int width, int height);
+int damage_tracker_empty(struct damage_tracker *tracker);
+
+// Damages surface with what was added since the last submit, clipped to a
+// width x height buffer, and starts over. Call before wl_surface_commit().
+void damage_tracker_submit(struct damage_tracker *tracker, struct wl_surface *surface,
+		int width, int height);
+
+void damage_tracker_print_stats(struct damage_tracker *tracker, FILE *out);
+
+#endif
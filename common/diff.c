@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+
+// xxHash64 primes
+#define PRIME1 0x9e3779b185ebca87ull
+#define PRIME2 0xc2b2ae3d27d4eb4full
+#define PRIME3 0x165667b19e3779f9ull
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+	return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+// xxHash64-style hash of len bytes. Four independent lanes over 32 byte
+// stripes keep the multipliers busy, the tail is folded in 8 bytes at a time.
+static uint64_t hash_span(const uint8_t *data, int len)
+{
+	uint64_t v1 = PRIME1 + PRIME2;
+	uint64_t v2 = PRIME2;
+	uint64_t v3 = 0;
+	uint64_t v4 = -PRIME1;
+
+	int i = 0;
+	for (; i + 32 <= len; i += 32) {
+		uint64_t w[4];
+		memcpy(w, data + i, sizeof(w));
+		v1 = round64(v1, w[0]);
+		v2 = round64(v2, w[1]);
+		v3 = round64(v3, w[2]);
+		v4 = round64(v4, w[3]);
+	}
+
+	uint64_t h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18) + len;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, data + i, sizeof(w));
+		h = rotl(h ^ round64(0, w), 27) * PRIME1 + PRIME3;
+	}
+
+	for (; i < len; i++)
+		h = rotl(h ^ (data[i] * PRIME3), 11) * PRIME1;
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static struct diff_rect rect_union(struct diff_rect a, struct diff_rect b)
+{
+	int x1 = a.x < b.x ? a.x : b.x;
+	int y1 = a.y < b.y ? a.y : b.y;
+	int x2 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+	int y2 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+
+	return (struct diff_rect){ x1, y1, x2 - x1, y2 - y1 };
+}
+
+// Adds a changed run of a row, growing a rect from the row above with the
+// same columns if there is one. Past max_rects everything is one bounding box.
+static int add_run(struct diff_rect *rects, int n, int max_rects, struct diff_rect run)
+{
+	for (int i = 0; i < n; i++) {
+		struct diff_rect *r = &rects[i];
+		if (r->x == run.x && r->width == run.width && r->y + r->height == run.y) {
+			r->height += run.height;
+			return n;
+		}
+	}
+
+	if (n < max_rects) {
+		rects[n] = run;
+		return n + 1;
+	}
+
+	for (int i = 1; i < n; i++)
+		run = rect_union(run, rects[i]);
+	rects[0] = rect_union(run, rects[0]);
+
+	return 1;
+}
+
+void frame_diff_init(struct frame_diff *diff)
+{
+	*diff = (struct frame_diff){ 0 };
+}
+
+void frame_diff_finish(struct frame_diff *diff)
+{
+	free(diff->hashes);
+	diff->hashes = NULL;
+}
+
+int frame_diff_update(struct frame_diff *diff, const void *pixels, int width,
+		int height, int bytes_per_pixel, struct diff_rect *rects, int max_rects)
+{
+	const int cols = (width + DIFF_SPAN - 1) / DIFF_SPAN;
+	const int stride = width * bytes_per_pixel;
+
+	// Nothing to compare against
+	int everything = 0;
+	if (!diff->hashes || diff->width != width || diff->rows != height) {
+		free(diff->hashes);
+		diff->hashes = malloc((size_t) cols * height * sizeof(*diff->hashes));
+
+		// Can't remember this frame, damage all of it and try again next time
+		if (!diff->hashes) {
+			if (max_rects < 1 || width <= 0 || height <= 0)
+				return 0;
+
+			rects[0] = (struct diff_rect){ 0, 0, width, height };
+			diff->pixels += (uint64_t) width * height;
+			diff->damaged += (uint64_t) width * height;
+			return 1;
+		}
+
+		diff->cols = cols;
+		diff->rows = height;
+		diff->width = width;
+		everything = 1;
+	}
+
+	int n = 0;
+	uint64_t damaged = 0;
+
+	for (int y = 0; y < height; y++) {
+		const uint8_t *row = (const uint8_t *) pixels + y * stride;
+		uint64_t *hashes = diff->hashes + y * cols;
+
+		int run_start = -1;
+		for (int col = 0; col <= cols; col++) {
+			int changed = 0;
+
+			if (col < cols) {
+				int x = col * DIFF_SPAN;
+				int span = width - x < DIFF_SPAN ? width - x : DIFF_SPAN;
+				uint64_t hash = hash_span(row + x * bytes_per_pixel, span * bytes_per_pixel);
+
+				changed = everything || hash != hashes[col];
+				hashes[col] = hash;
+			}
+
+			if (changed && run_start < 0)
+				run_start = col;
+
+			if (!changed && run_start >= 0) {
+				int x1 = run_start * DIFF_SPAN;
+				int x2 = col * DIFF_SPAN < width ? col * DIFF_SPAN : width;
+				n = add_run(rects, n, max_rects, (struct diff_rect){ x1, y, x2 - x1, 1 });
+				damaged += x2 - x1;
+				run_start = -1;
+			}
+		}
+	}
+
+	diff->pixels += (uint64_t) width * height;
+	diff->damaged += damaged;
+
+	return n;
+}
@@ -0,0 +1,43 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdint.h>
+
+/*
+ * Damage inference for drawing code that doesn't say what it changed.
+ *
+ * Every row of a frame is hashed in DIFF_SPAN pixel spans and compared against
+ * the hashes of the frame before it. The spans that differ are merged into a
+ * few rectangles, fit for wl_surface_damage_buffer().
+ */
+
+#define DIFF_SPAN 64
+
+struct diff_rect {
+	int x, y;
+	int width, height;
+};
+
+struct frame_diff {
+	// Span hashes of the last frame, rows x cols
+	uint64_t *hashes;
+	int cols;
+	int rows;
+	int width;
+
+	// Counters since init
+	uint64_t pixels;
+	uint64_t damaged;
+};
+
+void frame_diff_init(struct frame_diff *diff);
+void frame_diff_finish(struct frame_diff *diff);
+
+// Compares the frame in pixels, rows of width * bytes_per_pixel with no
+// padding, against the one from the previous call. Returns how many rects
+// cover what changed, at most max_rects, and 0 if nothing did. The first frame
+// and any size change damage everything.
+int frame_diff_update(struct frame_diff *diff, const void *pixels, int width,
+		int height, int bytes_per_pixel, struct diff_rect *rects, int max_rects);
+
+#endif
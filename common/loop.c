@@ -0,0 +1,361 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "loop.h"
+
+#define MAX_EVENTS 32
+
+enum source_type {
+	SOURCE_FD,
+	SOURCE_TIMER,
+	SOURCE_SIGNAL,
+	SOURCE_IDLE,
+};
+
+struct event_source {
+	struct event_loop *loop;
+	enum source_type type;
+	const char *name;
+
+	int fd;
+	int signal;
+
+	union {
+		event_fd_func fd;
+		event_timer_func timer;
+		event_signal_func signal;
+		event_idle_func idle;
+	} func;
+	void *data;
+
+	int removed;
+	// Idle taken off loop->idles by dispatch_idles()
+	int dispatching;
+
+	// Counters since the source was added
+	uint64_t dispatches;
+	uint64_t busy_ns;
+
+	struct event_source *prev, *next;
+};
+
+struct event_loop {
+	int epoll_fd;
+
+	// All live sources, and idle ones waiting to run
+	struct event_source *sources;
+	struct event_source *idles;
+
+	// Removed while events for them may still be pending, freed after dispatch
+	struct event_source *destroyed;
+
+	// Counters for sources that were removed, so stats add up
+	uint64_t removed_dispatches;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void list_insert(struct event_source **list, struct event_source *source)
+{
+	source->prev = NULL;
+	source->next = *list;
+	if (*list)
+		(*list)->prev = source;
+	*list = source;
+}
+
+static void list_remove(struct event_source **list, struct event_source *source)
+{
+	if (source->prev)
+		source->prev->next = source->next;
+	else
+		*list = source->next;
+	if (source->next)
+		source->next->prev = source->prev;
+}
+
+static struct event_source *source_new(struct event_loop *loop, enum source_type type,
+		int fd, void *data)
+{
+	struct event_source *source = calloc(1, sizeof(*source));
+	source->loop = loop;
+	source->type = type;
+	source->fd = fd;
+	source->data = data;
+
+	return source;
+}
+
+static struct event_source *source_add(struct event_loop *loop,
+		struct event_source *source, uint32_t mask)
+{
+	struct epoll_event event = {
+		.events = mask,
+		.data.ptr = source,
+	};
+
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &event) < 0) {
+		LOG("epoll_ctl add failed for fd %d", source->fd);
+		if (source->type != SOURCE_FD)
+			close(source->fd);
+		free(source);
+		return NULL;
+	}
+
+	list_insert(&loop->sources, source);
+
+	return source;
+}
+
+struct event_loop *event_loop_create(void)
+{
+	struct event_loop *loop = calloc(1, sizeof(*loop));
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+static void free_list(struct event_source *source)
+{
+	while (source) {
+		struct event_source *next = source->next;
+		free(source);
+		source = next;
+	}
+}
+
+void event_loop_destroy(struct event_loop *loop)
+{
+	while (loop->sources)
+		event_source_remove(loop->sources);
+
+	free_list(loop->idles);
+	free_list(loop->destroyed);
+
+	close(loop->epoll_fd);
+	free(loop);
+}
+
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+		uint32_t mask, event_fd_func func, void *data)
+{
+	struct event_source *source = source_new(loop, SOURCE_FD, fd, data);
+	source->func.fd = func;
+
+	return source_add(loop, source, mask);
+}
+
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+		event_timer_func func, void *data)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+
+	struct event_source *source = source_new(loop, SOURCE_TIMER, fd, data);
+	source->func.timer = func;
+
+	return source_add(loop, source, EPOLLIN);
+}
+
+struct event_source *event_loop_add_signal(struct event_loop *loop, int signal,
+		event_signal_func func, void *data)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, signal);
+
+	int fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+
+	// Otherwise the default action still runs. Threads created from here on
+	// inherit the mask.
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	struct event_source *source = source_new(loop, SOURCE_SIGNAL, fd, data);
+	source->signal = signal;
+	source->func.signal = func;
+
+	return source_add(loop, source, EPOLLIN);
+}
+
+struct event_source *event_loop_add_idle(struct event_loop *loop,
+		event_idle_func func, void *data)
+{
+	struct event_source *source = source_new(loop, SOURCE_IDLE, -1, data);
+	source->func.idle = func;
+
+	list_insert(&loop->idles, source);
+
+	return source;
+}
+
+int event_source_timer_update(struct event_source *source, int delay_ms, int interval_ms)
+{
+	struct itimerspec its = {
+		.it_value = { delay_ms / 1000, (delay_ms % 1000) * 1000000l },
+		.it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000l },
+	};
+
+	return timerfd_settime(source->fd, 0, &its, NULL);
+}
+
+int event_source_fd_update(struct event_source *source, uint32_t mask)
+{
+	struct epoll_event event = {
+		.events = mask,
+		.data.ptr = source,
+	};
+
+	return epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event);
+}
+
+void event_source_set_name(struct event_source *source, const char *name)
+{
+	source->name = name;
+}
+
+void event_source_remove(struct event_source *source)
+{
+	struct event_loop *loop = source->loop;
+
+	if (source->removed)
+		return;
+
+	source->removed = 1;
+
+	if (source->type == SOURCE_IDLE) {
+		// Already off the list, dispatch_idles() retires it
+		if (source->dispatching)
+			return;
+		list_remove(&loop->idles, source);
+	} else {
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+		if (source->type != SOURCE_FD)
+			close(source->fd);
+		source->fd = -1;
+		list_remove(&loop->sources, source);
+	}
+
+	list_insert(&loop->destroyed, source);
+}
+
+static void dispatch(struct event_source *source, uint32_t mask)
+{
+	uint64_t start = now_ns();
+
+	switch (source->type) {
+	case SOURCE_FD:
+		source->func.fd(source->fd, mask, source->data);
+		break;
+
+	case SOURCE_TIMER: {
+		uint64_t expirations;
+		if (read(source->fd, &expirations, sizeof(expirations)) <= 0)
+			return;
+		source->func.timer(source->data);
+		break;
+	}
+
+	case SOURCE_SIGNAL: {
+		struct signalfd_siginfo info;
+		if (read(source->fd, &info, sizeof(info)) <= 0)
+			return;
+		source->func.signal(source->signal, source->data);
+		break;
+	}
+
+	case SOURCE_IDLE:
+		source->func.idle(source->data);
+		break;
+	}
+
+	source->dispatches++;
+	source->busy_ns += now_ns() - start;
+}
+
+static void dispatch_idles(struct event_loop *loop)
+{
+	// Idles added by idle callbacks wait for the next round
+	struct event_source *idles = loop->idles;
+	loop->idles = NULL;
+
+	// Callbacks may remove any of these, themselves included
+	for (struct event_source *source = idles; source; source = source->next)
+		source->dispatching = 1;
+
+	while (idles) {
+		struct event_source *source = idles;
+		idles = source->next;
+
+		if (!source->removed)
+			dispatch(source, 0);
+
+		source->removed = 1;
+		list_insert(&loop->destroyed, source);
+	}
+}
+
+int event_loop_dispatch(struct event_loop *loop, int timeout)
+{
+	dispatch_idles(loop);
+
+	// Something new to do already, don't block
+	if (loop->idles)
+		timeout = 0;
+
+	struct epoll_event events[MAX_EVENTS];
+	int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+	if (n < 0 && errno != EINTR)
+		return -1;
+
+	for (int i = 0; i < n; i++) {
+		struct event_source *source = events[i].data.ptr;
+		if (!source->removed)
+			dispatch(source, events[i].events);
+	}
+
+	while (loop->destroyed) {
+		struct event_source *source = loop->destroyed;
+		loop->destroyed = source->next;
+
+		loop->removed_dispatches += source->dispatches;
+		free(source);
+	}
+
+	return 0;
+}
+
+void event_loop_print_stats(struct event_loop *loop, FILE *out)
+{
+	static const char *types[] = { "fd", "timer", "signal", "idle" };
+
+	for (struct event_source *source = loop->sources; source; source = source->next) {
+		fprintf(out, "loop: %-8s %-6s %8lu dispatches, %.3f ms\n",
+				source->name ? source->name : "-", types[source->type],
+				(unsigned long) source->dispatches, source->busy_ns / 1e6);
+	}
+
+	if (loop->removed_dispatches)
+		fprintf(out, "loop: %lu dispatches by removed sources\n",
+				(unsigned long) loop->removed_dispatches);
+}
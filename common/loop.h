@@ -0,0 +1,71 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+
+/*
+ * An epoll event loop with fd, timer, signal and idle sources.
+ *
+ * Adding or removing a source is a single epoll_ctl(), so apps register their
+ * sockets next to the Wayland fd instead of rebuilding poll sets. Every source
+ * counts how often it was dispatched and how long its callbacks took.
+ */
+
+enum {
+	EVENT_READABLE = EPOLLIN,
+	EVENT_WRITABLE = EPOLLOUT,
+	EVENT_HANGUP = EPOLLHUP,
+	EVENT_ERROR = EPOLLERR,
+};
+
+struct event_loop;
+struct event_source;
+
+typedef void (*event_fd_func)(int fd, uint32_t mask, void *data);
+typedef void (*event_timer_func)(void *data);
+typedef void (*event_signal_func)(int signal, void *data);
+typedef void (*event_idle_func)(void *data);
+
+struct event_loop *event_loop_create(void);
+void event_loop_destroy(struct event_loop *loop);
+
+// The loop doesn't take ownership of fd
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+		uint32_t mask, event_fd_func func, void *data);
+
+// Disarmed until event_source_timer_update()
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+		event_timer_func func, void *data);
+
+// Blocks signal in the calling thread and delivers it through the loop.
+// Threads started before this keep the signal unblocked and may still be
+// handed it, so add signal sources before creating any threads. Returns NULL
+// on failure.
+struct event_source *event_loop_add_signal(struct event_loop *loop, int signal,
+		event_signal_func func, void *data);
+
+// Runs once, before the loop next waits for events, then goes away
+struct event_source *event_loop_add_idle(struct event_loop *loop,
+		event_idle_func func, void *data);
+
+// Fires after delay_ms, then every interval_ms if that's not 0. A delay of 0
+// disarms the timer.
+int event_source_timer_update(struct event_source *source, int delay_ms, int interval_ms);
+
+int event_source_fd_update(struct event_source *source, uint32_t mask);
+
+// Shown in event_loop_print_stats()
+void event_source_set_name(struct event_source *source, const char *name);
+
+// Safe to call from any callback, including the source's own
+void event_source_remove(struct event_source *source);
+
+// Runs idle sources, waits up to timeout ms (-1 for ever) and dispatches
+// whatever is ready. Returns -1 if waiting failed.
+int event_loop_dispatch(struct event_loop *loop, int timeout);
+
+void event_loop_print_stats(struct event_loop *loop, FILE *out);
+
+#endif
@@ -0,0 +1,175 @@
+#include <stddef.h>
+
+#include "pattern.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATTERN_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PATTERN_NEON
+#endif
+
+static inline uint32_t pixel(int x, int y, uint32_t d1, uint32_t d2)
+{
+	uint8_t r = (x + d2) ^ y;
+	uint8_t g = (x + d1) ^ (y + d2);
+	uint8_t b = x ^ (y + d1);
+
+	return (r << 16) + (g << 8) + b;
+}
+
+static void fill_scalar(uint32_t *pixels, int width, int height, uint32_t time)
+{
+	uint32_t d1 = time / 10;
+	uint32_t d2 = time / 5;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			pixels[y * width + x] = pixel(x, y, d1, d2);
+	}
+}
+
+#ifdef PATTERN_X86
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *pixels, int width, int height, uint32_t time)
+{
+	uint32_t d1 = time / 10;
+	uint32_t d2 = time / 5;
+
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i vd1 = _mm_set1_epi32(d1);
+	const __m128i vd2 = _mm_set1_epi32(d2);
+
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = pixels + y * width;
+		const __m128i yr = _mm_set1_epi32(y);
+		const __m128i yg = _mm_set1_epi32(y + d2);
+		const __m128i yb = _mm_set1_epi32(y + d1);
+
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			__m128i vx = _mm_add_epi32(_mm_set1_epi32(x), lanes);
+			__m128i r = _mm_and_si128(_mm_xor_si128(_mm_add_epi32(vx, vd2), yr), mask);
+			__m128i g = _mm_and_si128(_mm_xor_si128(_mm_add_epi32(vx, vd1), yg), mask);
+			__m128i b = _mm_and_si128(_mm_xor_si128(vx, yb), mask);
+			__m128i p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16),
+					_mm_slli_epi32(g, 8)), b);
+			_mm_storeu_si128((__m128i *) (row + x), p);
+		}
+
+		for (; x < width; x++)
+			row[x] = pixel(x, y, d1, d2);
+	}
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *pixels, int width, int height, uint32_t time)
+{
+	uint32_t d1 = time / 10;
+	uint32_t d2 = time / 5;
+
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i vd1 = _mm256_set1_epi32(d1);
+	const __m256i vd2 = _mm256_set1_epi32(d2);
+
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = pixels + y * width;
+		const __m256i yr = _mm256_set1_epi32(y);
+		const __m256i yg = _mm256_set1_epi32(y + d2);
+		const __m256i yb = _mm256_set1_epi32(y + d1);
+
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i vx = _mm256_add_epi32(_mm256_set1_epi32(x), lanes);
+			__m256i r = _mm256_and_si256(_mm256_xor_si256(_mm256_add_epi32(vx, vd2), yr), mask);
+			__m256i g = _mm256_and_si256(_mm256_xor_si256(_mm256_add_epi32(vx, vd1), yg), mask);
+			__m256i b = _mm256_and_si256(_mm256_xor_si256(vx, yb), mask);
+			__m256i p = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 16),
+					_mm256_slli_epi32(g, 8)), b);
+			_mm256_storeu_si256((__m256i *) (row + x), p);
+		}
+
+		for (; x < width; x++)
+			row[x] = pixel(x, y, d1, d2);
+	}
+}
+#endif
+
+#ifdef PATTERN_NEON
+static void fill_neon(uint32_t *pixels, int width, int height, uint32_t time)
+{
+	uint32_t d1 = time / 10;
+	uint32_t d2 = time / 5;
+
+	const uint32x4_t mask = vdupq_n_u32(0xff);
+	const uint32_t lane_values[4] = { 0, 1, 2, 3 };
+	const uint32x4_t lanes = vld1q_u32(lane_values);
+	const uint32x4_t vd1 = vdupq_n_u32(d1);
+	const uint32x4_t vd2 = vdupq_n_u32(d2);
+
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = pixels + y * width;
+		const uint32x4_t yr = vdupq_n_u32(y);
+		const uint32x4_t yg = vdupq_n_u32(y + d2);
+		const uint32x4_t yb = vdupq_n_u32(y + d1);
+
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			uint32x4_t vx = vaddq_u32(vdupq_n_u32(x), lanes);
+			uint32x4_t r = vandq_u32(veorq_u32(vaddq_u32(vx, vd2), yr), mask);
+			uint32x4_t g = vandq_u32(veorq_u32(vaddq_u32(vx, vd1), yg), mask);
+			uint32x4_t b = vandq_u32(veorq_u32(vx, yb), mask);
+			uint32x4_t p = vorrq_u32(vorrq_u32(vshlq_n_u32(r, 16), vshlq_n_u32(g, 8)), b);
+			vst1q_u32(row + x, p);
+		}
+
+		for (; x < width; x++)
+			row[x] = pixel(x, y, d1, d2);
+	}
+}
+#endif
+
+static struct pattern_kernel kernels[4];
+static int n_kernels;
+
+static void init_kernels()
+{
+	kernels[n_kernels++] = (struct pattern_kernel){ "scalar", fill_scalar };
+
+#ifdef PATTERN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		kernels[n_kernels++] = (struct pattern_kernel){ "sse2", fill_sse2 };
+	if (__builtin_cpu_supports("avx2"))
+		kernels[n_kernels++] = (struct pattern_kernel){ "avx2", fill_avx2 };
+#endif
+
+#ifdef PATTERN_NEON
+	kernels[n_kernels++] = (struct pattern_kernel){ "neon", fill_neon };
+#endif
+}
+
+int pattern_kernels(const struct pattern_kernel **out)
+{
+	if (n_kernels == 0)
+		init_kernels();
+
+	*out = kernels;
+	return n_kernels;
+}
+
+void pattern_fill(uint32_t *pixels, int width, int height, uint32_t time)
+{
+	static void (*fill)(uint32_t *pixels, int width, int height, uint32_t time);
+
+	if (!fill) {
+		const struct pattern_kernel *k;
+		int n = pattern_kernels(&k);
+		fill = k[n - 1].fill;
+	}
+
+	fill(pixels, width, height, time);
+}
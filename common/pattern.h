@@ -0,0 +1,23 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+
+/*
+ * The animated xor pattern drawn by the animation and subsurfaces samples,
+ * with SIMD kernels picked for the running CPU. Every kernel produces the
+ * same pixels as the scalar one.
+ */
+
+struct pattern_kernel {
+	const char *name;
+	void (*fill)(uint32_t *pixels, int width, int height, uint32_t time);
+};
+
+// Fills width x height XRGB8888 pixels using the best kernel for this CPU
+void pattern_fill(uint32_t *pixels, int width, int height, uint32_t time);
+
+// Kernels usable on this CPU, scalar reference first and best last
+int pattern_kernels(const struct pattern_kernel **kernels);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+/*
+ * Per-format pixel writers.
+ *
+ * PIXEL_FORMATS(X) expands X(name, wl_shm_format, pixel_type) for every
+ * format we know how to fill. Drawing code instantiates one kernel per format
+ * with it and picks the right one once per call through PIXEL_DISPATCH, so the
+ * pack_*() call inside the inner loop is resolved at compile time.
+ */
+
+#define PIXEL_FORMATS(X) \
+	X(argb8888, WL_SHM_FORMAT_ARGB8888, uint32_t) \
+	X(xrgb8888, WL_SHM_FORMAT_XRGB8888, uint32_t) \
+	X(rgb565, WL_SHM_FORMAT_RGB565, uint16_t)
+
+static inline uint32_t pack_argb8888(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	return ((uint32_t) a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static inline uint32_t pack_xrgb8888(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	return (r << 16) | (g << 8) | b;
+}
+
+static inline uint16_t pack_rgb565(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+// Bytes per pixel, 0 for formats not in PIXEL_FORMATS
+static inline int pixel_size(uint32_t format)
+{
+#define X(name, wl_format, type) if (format == wl_format) return sizeof(type);
+	PIXEL_FORMATS(X)
+#undef X
+	return 0;
+}
+
+// Calls fn_<name>(...) for the format
+#define PIXEL_DISPATCH(format, fn, ...) \
+	do { \
+		switch (format) { \
+		case WL_SHM_FORMAT_ARGB8888: fn##_argb8888(__VA_ARGS__); break; \
+		case WL_SHM_FORMAT_XRGB8888: fn##_xrgb8888(__VA_ARGS__); break; \
+		case WL_SHM_FORMAT_RGB565: fn##_rgb565(__VA_ARGS__); break; \
+		} \
+	} while (0)
+
+#endif
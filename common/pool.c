@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "log.h"
+#include "pool.h"
+
+// Address space reserved per pool. wl_shm_pool sizes are int32_t anyway.
+#define SHM_POOL_MAX_SIZE ((size_t) 1 << 30)
+
+static size_t page_align(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+static struct shm_block *block_new(struct shm_pool *pool, size_t offset, size_t size)
+{
+	struct shm_block *block = calloc(1, sizeof(*block));
+
+	block->pool = pool;
+	block->offset = offset;
+	block->size = size;
+	block->data = (uint8_t *) pool->data + offset;
+	block->free = 1;
+
+	return block;
+}
+
+// Map [pool->size, size) of the file into the reserved range
+static int pool_map(struct shm_pool *pool, size_t size)
+{
+	int ret;
+	do {
+		ret = ftruncate(pool->fd, size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	void *addr = mmap((uint8_t *) pool->data + pool->size, size - pool->size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pool->fd, pool->size);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	pool->size = size;
+
+	return 0;
+}
+
+static int pool_grow(struct shm_pool *pool, size_t needed)
+{
+	size_t size = pool->size;
+	while (size < pool->size + needed)
+		size *= 2;
+
+	if (size > SHM_POOL_MAX_SIZE)
+		return -1;
+
+	size_t old_size = pool->size;
+	if (pool_map(pool, size) < 0)
+		return -1;
+
+	wl_shm_pool_resize(pool->wl_shm_pool, size);
+	pool->grows++;
+
+	LOG("Pool grown from %zu to %zu bytes", old_size, size);
+
+	// Hand the new tail over to the free list
+	struct shm_block **link = &pool->blocks;
+	struct shm_block *last = NULL;
+	while (*link) {
+		last = *link;
+		link = &(*link)->next;
+	}
+
+	if (last && last->free)
+		last->size += size - old_size;
+	else
+		*link = block_new(pool, old_size, size - old_size);
+
+	return 0;
+}
+
+struct shm_pool *shm_pool_create(struct wl_shm *wl_shm, size_t size)
+{
+	struct shm_pool *pool = calloc(1, sizeof(*pool));
+	pool->wl_shm = wl_shm;
+	pool->fd = memfd_create("shm-pool", MFD_CLOEXEC);
+	if (pool->fd < 0)
+		goto err;
+
+	pool->data = mmap(NULL, SHM_POOL_MAX_SIZE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pool->data == MAP_FAILED)
+		goto err_fd;
+
+	size = page_align(size ? size : 1);
+	if (pool_map(pool, size) < 0)
+		goto err_map;
+
+	pool->wl_shm_pool = wl_shm_create_pool(wl_shm, pool->fd, size);
+	pool->blocks = block_new(pool, 0, size);
+
+	return pool;
+
+err_map:
+	munmap(pool->data, SHM_POOL_MAX_SIZE);
+err_fd:
+	close(pool->fd);
+err:
+	free(pool);
+	return NULL;
+}
+
+void shm_pool_destroy(struct shm_pool *pool)
+{
+	struct shm_block *block = pool->blocks;
+	while (block) {
+		struct shm_block *next = block->next;
+		if (!block->free)
+			LOG("Destroying pool with block at %zu still in use", block->offset);
+		free(block);
+		block = next;
+	}
+
+	wl_shm_pool_destroy(pool->wl_shm_pool);
+	munmap(pool->data, SHM_POOL_MAX_SIZE);
+	close(pool->fd);
+
+	free(pool);
+}
+
+struct shm_block *shm_pool_alloc(struct shm_pool *pool, size_t size)
+{
+	size = page_align(size);
+
+	int grown = 0;
+	struct shm_block *block;
+	for (;;) {
+		// First fit
+		for (block = pool->blocks; block; block = block->next) {
+			if (block->free && block->size >= size)
+				break;
+		}
+
+		if (block)
+			break;
+
+		if (grown || pool_grow(pool, size) < 0)
+			return NULL;
+		grown = 1;
+	}
+
+	// Split off the remainder
+	if (block->size > size) {
+		struct shm_block *rest = block_new(pool, block->offset + size, block->size - size);
+		rest->next = block->next;
+		block->next = rest;
+		block->size = size;
+	}
+
+	block->free = 0;
+
+	// Only memory that was freed before counts, not a fresh part of the pool
+	pool->allocs++;
+	if (block->offset + block->size <= pool->high_water)
+		pool->reuses++;
+	else
+		pool->high_water = block->offset + block->size;
+
+	return block;
+}
+
+void shm_pool_free(struct shm_block *block)
+{
+	struct shm_pool *pool = block->pool;
+
+	block->free = 1;
+
+	// Coalesce with the following block
+	struct shm_block *next = block->next;
+	if (next && next->free) {
+		block->size += next->size;
+		block->next = next->next;
+		free(next);
+	}
+
+	// ...and with the preceding one
+	struct shm_block *prev = pool->blocks;
+	while (prev && prev->next != block)
+		prev = prev->next;
+
+	if (prev && prev->free) {
+		prev->size += block->size;
+		prev->next = block->next;
+		free(block);
+	}
+}
+
+struct wl_buffer *shm_block_create_buffer(struct shm_block *block,
+		int width, int height, int stride, uint32_t format)
+{
+	return wl_shm_pool_create_buffer(block->pool->wl_shm_pool, block->offset,
+			width, height, stride, format);
+}
+
+void shm_pool_get_stats(struct shm_pool *pool, struct shm_pool_stats *stats)
+{
+	*stats = (struct shm_pool_stats){
+		.size = pool->size,
+		.allocs = pool->allocs,
+		.reuses = pool->reuses,
+		.grows = pool->grows,
+	};
+
+	for (struct shm_block *block = pool->blocks; block; block = block->next) {
+		stats->blocks++;
+
+		if (!block->free) {
+			stats->used += block->size;
+			continue;
+		}
+
+		stats->free += block->size;
+		stats->free_blocks++;
+		if (block->size > stats->largest_free)
+			stats->largest_free = block->size;
+	}
+}
+
+double shm_pool_fragmentation(struct shm_pool *pool)
+{
+	struct shm_pool_stats stats;
+	shm_pool_get_stats(pool, &stats);
+
+	if (stats.free == 0)
+		return 0;
+
+	return 1.0 - (double) stats.largest_free / stats.free;
+}
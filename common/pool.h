@@ -0,0 +1,75 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A single memfd-backed wl_shm_pool that many wl_buffers are cut from.
+ *
+ * The pool reserves its maximum address range up front and maps the file into
+ * it as it grows, so pointers handed out by shm_pool_alloc() stay valid across
+ * wl_shm_pool_resize(). Freed blocks go back on a first-fit free list and are
+ * coalesced with their neighbours.
+ */
+
+struct shm_block {
+	struct shm_pool *pool;
+
+	size_t offset;
+	size_t size;
+	void *data;
+
+	int free;
+	struct shm_block *next;
+};
+
+struct shm_pool_stats {
+	size_t size;
+	size_t used;
+	size_t free;
+	size_t largest_free;
+
+	int blocks;
+	int free_blocks;
+
+	// Counters since the pool was created
+	int allocs;
+	int reuses;
+	int grows;
+};
+
+struct shm_pool {
+	struct wl_shm *wl_shm;
+	struct wl_shm_pool *wl_shm_pool;
+
+	int fd;
+	void *data;
+	size_t size;
+
+	// All blocks, sorted by offset
+	struct shm_block *blocks;
+
+	// Bytes below this have been handed out before
+	size_t high_water;
+
+	int allocs;
+	int reuses;
+	int grows;
+};
+
+struct shm_pool *shm_pool_create(struct wl_shm *wl_shm, size_t size);
+void shm_pool_destroy(struct shm_pool *pool);
+
+struct shm_block *shm_pool_alloc(struct shm_pool *pool, size_t size);
+void shm_pool_free(struct shm_block *block);
+
+struct wl_buffer *shm_block_create_buffer(struct shm_block *block,
+		int width, int height, int stride, uint32_t format);
+
+void shm_pool_get_stats(struct shm_pool *pool, struct shm_pool_stats *stats);
+
+// Share of free memory not usable for the largest possible allocation, 0..1
+double shm_pool_fragmentation(struct shm_pool *pool);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "premultiply.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREMULTIPLY_X86
+#endif
+
+// c * a / 255, rounded
+static inline uint32_t mul255(uint32_t c, uint32_t a)
+{
+	uint32_t t = c * a + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+static void row_scalar(uint32_t *p, int n)
+{
+	for (int i = 0; i < n; i++) {
+		uint32_t a = p[i] >> 24;
+		if (a == 0xff)
+			continue;
+
+		uint32_t r = mul255((p[i] >> 16) & 0xff, a);
+		uint32_t g = mul255((p[i] >> 8) & 0xff, a);
+		uint32_t b = mul255(p[i] & 0xff, a);
+		p[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+}
+
+#ifdef PREMULTIPLY_X86
+// Same rounding as mul255() on 16 bit lanes holding b, g, r, a per pixel. The
+// alpha lane is multiplied by 255 so it comes out as it went in.
+__attribute__((target("sse2")))
+static inline __m128i mul255_sse2(__m128i c, __m128i a)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i alpha_sse2(__m128i c)
+{
+	const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i alpha_255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+	__m128i a = _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3));
+	a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+
+	return _mm_or_si128(_mm_andnot_si128(alpha_lanes, a), alpha_255);
+}
+
+__attribute__((target("sse2")))
+static void row_sse2(uint32_t *p, int n)
+{
+	const __m128i opaque = _mm_set1_epi32(0xff000000);
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *) (p + i));
+
+		// All four opaque
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, opaque), opaque)) == 0xffff)
+			continue;
+
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		lo = mul255_sse2(lo, alpha_sse2(lo));
+		hi = mul255_sse2(hi, alpha_sse2(hi));
+
+		_mm_storeu_si128((__m128i *) (p + i), _mm_packus_epi16(lo, hi));
+	}
+
+	row_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void row_avx2(uint32_t *p, int n)
+{
+	const __m256i opaque = _mm256_set1_epi32(0xff000000);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha_shuffle = _mm256_setr_epi8(
+			6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1,
+			6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1);
+	const __m256i alpha_255 = _mm256_set1_epi64x(0x00ff000000000000ll);
+	const __m256i round = _mm256_set1_epi16(128);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *) (p + i));
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(v, opaque), opaque)) == -1)
+			continue;
+
+		// unpack/pack work within 128 bit halves, so pixel order survives
+		__m256i lo = _mm256_unpacklo_epi8(v, zero);
+		__m256i hi = _mm256_unpackhi_epi8(v, zero);
+
+		__m256i alo = _mm256_or_si256(_mm256_shuffle_epi8(lo, alpha_shuffle), alpha_255);
+		__m256i ahi = _mm256_or_si256(_mm256_shuffle_epi8(hi, alpha_shuffle), alpha_255);
+
+		__m256i tlo = _mm256_add_epi16(_mm256_mullo_epi16(lo, alo), round);
+		__m256i thi = _mm256_add_epi16(_mm256_mullo_epi16(hi, ahi), round);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(tlo, _mm256_srli_epi16(tlo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(thi, _mm256_srli_epi16(thi, 8)), 8);
+
+		_mm256_storeu_si256((__m256i *) (p + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	row_sse2(p + i, n - i);
+}
+#endif
+
+void premultiply_argb8888(void *pixels, int stride, int x, int y, int width, int height)
+{
+	static void (*row)(uint32_t *p, int n);
+
+	if (!row) {
+		row = row_scalar;
+#ifdef PREMULTIPLY_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			row = row_sse2;
+		if (__builtin_cpu_supports("avx2"))
+			row = row_avx2;
+#endif
+	}
+
+	for (int j = y; j < y + height; j++)
+		row((uint32_t *) ((uint8_t *) pixels + j * stride) + x, width);
+}
@@ -0,0 +1,16 @@
+#ifndef PREMULTIPLY_H
+#define PREMULTIPLY_H
+
+/*
+ * wl_shm ARGB8888 is premultiplied: the colour channels must already be
+ * scaled by alpha. Drawing code that writes straight alpha runs the damaged
+ * part of the buffer through premultiply_argb8888() before attaching it.
+ *
+ * Opaque pixels come out unchanged and aren't written back, so opaque
+ * content costs a read. Opaque formats shouldn't call it at all.
+ */
+
+// Premultiplies x, y, width x height of a buffer stride bytes wide in place
+void premultiply_argb8888(void *pixels, int stride, int x, int y, int width, int height);
+
+#endif
@@ -3,11 +3,17 @@
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "shm.h"
+
+// Default hugetlbfs page size on x86-64 and most arm64 kernels
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 static void
 randname(char *buf)
 {
@@ -53,4 +59,121 @@ int allocate_shm_file(size_t size)
 	return fd;
 }
 
+size_t shm_file_size(size_t size, int flags)
+{
+	// hugetlbfs sizes must be a multiple of the huge page size
+	if (flags & SHM_HUGETLB)
+		return (size + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+
+	return size;
+}
+
+static int allocate_hugetlb_file(size_t size)
+{
+	int fd = memfd_create("wl_shm", MFD_CLOEXEC | MFD_HUGETLB);
+	if (fd < 0)
+		return -1;
+
+	size = shm_file_size(size, SHM_HUGETLB);
+	if (ftruncate(fd, size) < 0)
+		goto err;
+
+	// Pages are only reserved at mmap time. Probe now, so running out of
+	// huge pages means a fallback here rather than SIGBUS on first write.
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		goto err;
+	munmap(data, size);
+
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+int allocate_shm_file_flags(size_t size, int *flags)
+{
+	if (*flags & SHM_HUGETLB) {
+		int fd = allocate_hugetlb_file(size);
+		if (fd >= 0)
+			return fd;
+
+		*flags = (*flags & ~SHM_HUGETLB) | SHM_THP;
+	}
+
+	return allocate_shm_file(size);
+}
+
+void *map_shm_file(int fd, size_t size, int flags)
+{
+	size = shm_file_size(size, flags);
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		return data;
 
+	advise_shm(data, size, flags);
+
+	return data;
+}
+
+int unmap_shm_file(void *data, size_t size, int flags)
+{
+	return munmap(data, shm_file_size(size, flags));
+}
+
+int advise_shm(void *data, size_t size, int flags)
+{
+	int applied = flags & SHM_HUGETLB;
+
+	// Best effort, shmem THP also depends on
+	// /sys/kernel/mm/transparent_hugepage/shmem_enabled
+	if ((flags & SHM_THP) && madvise(data, size, MADV_HUGEPAGE) == 0)
+		applied |= SHM_THP;
+
+	if (flags & SHM_POPULATE) {
+		int ret = -1;
+#ifdef MADV_POPULATE_WRITE
+		ret = madvise(data, size, MADV_POPULATE_WRITE);
+#endif
+		// Pre-5.14 kernels: write fault every page by hand
+		if (ret < 0) {
+			long page = sysconf(_SC_PAGESIZE);
+			for (size_t offset = 0; offset < size; offset += page)
+				((volatile char *) data)[offset] = 0;
+		}
+
+		applied |= SHM_POPULATE;
+	}
+
+	if ((flags & SHM_LOCK) && mlock(data, size) == 0)
+		applied |= SHM_LOCK;
+
+	return applied;
+}
+
+int punch_shm_file(int fd, size_t offset, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = (offset + page - 1) & ~(page - 1);
+	size_t end = (offset + size) & ~(page - 1);
+
+	if (end <= start)
+		return 0;
+
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start);
+}
+
+size_t get_rss(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	size_t pages = 0;
+	fscanf(f, "%*s %zu", &pages);
+	fclose(f);
+
+	return pages * sysconf(_SC_PAGESIZE);
+}
@@ -3,6 +3,41 @@
 
 #include <sys/types.h>
 
+// Flags for allocate_shm_file_flags() and map_shm_file()
+enum shm_flags {
+	// Back the file with hugetlbfs pages (MFD_HUGETLB), falls back to SHM_THP
+	SHM_HUGETLB = 1 << 0,
+	// Ask for transparent huge pages on the mapping (MADV_HUGEPAGE)
+	SHM_THP = 1 << 1,
+	// Fault the whole mapping in up front (MADV_POPULATE_WRITE)
+	SHM_POPULATE = 1 << 2,
+	// Keep the mapping resident (mlock), best effort under RLIMIT_MEMLOCK
+	SHM_LOCK = 1 << 3,
+};
+
 int allocate_shm_file(size_t size);
 
+// On return *flags holds the flags that actually took effect
+int allocate_shm_file_flags(size_t size, int *flags);
+
+// Size of the file allocate_shm_file_flags() creates for size bytes with the
+// flags that took effect, rounded up to whole huge pages for SHM_HUGETLB
+size_t shm_file_size(size_t size, int flags);
+
+// mmap()s a file returned by allocate_shm_file_flags(), MAP_FAILED on error.
+// Maps shm_file_size() bytes, unmap with unmap_shm_file().
+void *map_shm_file(int fd, size_t size, int flags);
+int unmap_shm_file(void *data, size_t size, int flags);
+
+// Applies SHM_THP, SHM_POPULATE and SHM_LOCK to an existing mapping and returns
+// the ones that took effect. Prefaulting may clobber the contents.
+int advise_shm(void *data, size_t size, int flags);
+
+// Frees the pages backing [offset, offset + size) without changing the file
+// size, they read back as zeros. offset and size are rounded inwards to pages.
+int punch_shm_file(int fd, size_t offset, size_t size);
+
+// Resident set size of the calling process in bytes
+size_t get_rss(void);
+
 #endif
@@ -0,0 +1,305 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tiles.h"
+
+// Tile indices [top, bottom) packed into one word, so the owner popping from
+// the bottom and thieves taking from the top only need a compare-and-swap
+struct deque {
+	uint64_t range;
+} __attribute__((aligned(64)));
+
+#define RANGE(top, bottom) (((uint64_t) (top) << 32) | (uint32_t) (bottom))
+#define TOP(range) ((int) ((range) >> 32))
+#define BOTTOM(range) ((int) (uint32_t) (range))
+
+struct tile_pool {
+	pthread_t *workers;
+	int threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	struct deque *deques;
+	struct tile_stats *stats;
+
+	// Current job
+	tile_kernel kernel;
+	void *data;
+	int width, height;
+	int cols, rows;
+
+	// Nanoseconds per tile in the last frame
+	uint64_t *costs;
+	int costs_size;
+
+	// Threads still looking for tiles
+	int active;
+
+	unsigned int generation;
+	int quit;
+};
+
+struct worker {
+	struct tile_pool *pool;
+	int index;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int pop_bottom(struct deque *deque)
+{
+	uint64_t range = __atomic_load_n(&deque->range, __ATOMIC_ACQUIRE);
+
+	while (TOP(range) < BOTTOM(range)) {
+		uint64_t taken = RANGE(TOP(range), BOTTOM(range) - 1);
+		if (__atomic_compare_exchange_n(&deque->range, &range, taken, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return BOTTOM(range) - 1;
+	}
+
+	return -1;
+}
+
+static int steal_top(struct deque *deque)
+{
+	uint64_t range = __atomic_load_n(&deque->range, __ATOMIC_ACQUIRE);
+
+	while (TOP(range) < BOTTOM(range)) {
+		uint64_t taken = RANGE(TOP(range) + 1, BOTTOM(range));
+		if (__atomic_compare_exchange_n(&deque->range, &range, taken, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return TOP(range);
+	}
+
+	return -1;
+}
+
+static void run_tile(struct tile_pool *pool, int self, int tile)
+{
+	int x = tile % pool->cols * TILE_SIZE;
+	int y = tile / pool->cols * TILE_SIZE;
+	int width = pool->width - x < TILE_SIZE ? pool->width - x : TILE_SIZE;
+	int height = pool->height - y < TILE_SIZE ? pool->height - y : TILE_SIZE;
+
+	uint64_t start = now_ns();
+	pool->kernel(x, y, width, height, pool->data);
+	uint64_t cost = now_ns() - start;
+
+	pool->costs[tile] = cost;
+	pool->stats[self].tiles++;
+	pool->stats[self].busy_ns += cost;
+}
+
+// Runs tiles until every deque is empty. Called without the lock.
+static void run_tiles(struct tile_pool *pool, int self)
+{
+	int tile;
+
+	while ((tile = pop_bottom(&pool->deques[self])) >= 0)
+		run_tile(pool, self, tile);
+
+	// Our own tiles are done, help the others. Nothing gets pushed during a
+	// frame, so one pass over empty deques means we're finished.
+	for (int i = 1; i < pool->threads; i++) {
+		int victim = (self + i) % pool->threads;
+
+		while ((tile = steal_top(&pool->deques[victim])) >= 0) {
+			pool->stats[self].steals++;
+			run_tile(pool, self, tile);
+		}
+	}
+}
+
+static void *worker(void *data)
+{
+	struct worker *w = data;
+	struct tile_pool *pool = w->pool;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (pool->generation == generation && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		pool->active++;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_tiles(pool, w->index);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0)
+			pthread_cond_signal(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	free(w);
+
+	return NULL;
+}
+
+struct tile_pool *tile_pool_create(int threads)
+{
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+
+	struct tile_pool *pool = calloc(1, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->workers = calloc(threads, sizeof(*pool->workers));
+	pool->deques = aligned_alloc(64, threads * sizeof(*pool->deques));
+	pool->stats = calloc(threads, sizeof(*pool->stats));
+
+	// Thread 0 is whoever calls tile_pool_run()
+	pool->threads = 1;
+	for (int i = 1; i < threads; i++) {
+		struct worker *w = malloc(sizeof(*w));
+		*w = (struct worker){ pool, i };
+
+		if (pthread_create(&pool->workers[i], NULL, worker, w) != 0) {
+			LOG("Failed to start worker %d", i);
+			free(w);
+			break;
+		}
+		pool->threads++;
+	}
+
+	LOG("Tile pool with %d threads", pool->threads);
+
+	return pool;
+}
+
+void tile_pool_destroy(struct tile_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 1; i < pool->threads; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->costs);
+	free(pool->stats);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+void tile_pool_run(struct tile_pool *pool, int width, int height,
+		tile_kernel kernel, void *data)
+{
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (!pool) {
+		kernel(0, 0, width, height, data);
+		return;
+	}
+
+	int cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles = cols * rows;
+
+	if (tiles > pool->costs_size) {
+		free(pool->costs);
+		pool->costs = calloc(tiles, sizeof(*pool->costs));
+		pool->costs_size = tiles;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	pool->kernel = kernel;
+	pool->data = data;
+	pool->width = width;
+	pool->height = height;
+	pool->cols = cols;
+	pool->rows = rows;
+
+	// Contiguous runs keep neighbouring tiles, and their cache lines, together
+	for (int i = 0; i < pool->threads; i++) {
+		int top = tiles * i / pool->threads;
+		int bottom = tiles * (i + 1) / pool->threads;
+		pool->stats[i] = (struct tile_stats){ 0 };
+		__atomic_store_n(&pool->deques[i].range, RANGE(top, bottom), __ATOMIC_RELEASE);
+	}
+
+	// A worker that woke up too late for the last frame may still be counted
+	pool->active++;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_tiles(pool, 0);
+
+	// Every tile is taken now, wait for the ones still being drawn
+	pthread_mutex_lock(&pool->lock);
+	pool->active--;
+	while (pool->active > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int tile_pool_threads(struct tile_pool *pool)
+{
+	return pool ? pool->threads : 1;
+}
+
+void tile_pool_get_stats(struct tile_pool *pool, int thread, struct tile_stats *stats)
+{
+	*stats = pool->stats[thread];
+}
+
+void tile_pool_print_heatmap(struct tile_pool *pool, FILE *out)
+{
+	static const char shades[] = " .:-=+*#%@";
+	const int levels = sizeof(shades) - 2;
+
+	int tiles = pool->cols * pool->rows;
+	uint64_t max = 0, total = 0;
+	for (int i = 0; i < tiles; i++) {
+		total += pool->costs[i];
+		if (pool->costs[i] > max)
+			max = pool->costs[i];
+	}
+
+	fprintf(out, "Tiles: %dx%d, %.1f us total, %.1f us slowest ('%c')\n",
+			pool->cols, pool->rows, total / 1e3, max / 1e3, shades[levels]);
+
+	for (int row = 0; row < pool->rows; row++) {
+		for (int col = 0; col < pool->cols; col++) {
+			uint64_t cost = pool->costs[row * pool->cols + col];
+			fputc(shades[max ? cost * levels / max : 0], out);
+		}
+		fputc('\n', out);
+	}
+
+	for (int i = 0; i < pool->threads; i++) {
+		fprintf(out, "Thread %d: %d tiles, %d stolen, %.1f us busy\n", i,
+				pool->stats[i].tiles, pool->stats[i].steals,
+				pool->stats[i].busy_ns / 1e3);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Parallel drawing in TILE_SIZE x TILE_SIZE tiles with work stealing.
+ *
+ * Every thread starts a frame with a contiguous run of tiles in its own deque.
+ * It works through them from the back, and once they're gone steals from the
+ * front of the others' deques. Frames where a few tiles cost most of the time
+ * (text, strokes) still keep every thread busy until the end.
+ *
+ * The time each tile took is kept for the last frame, see tile_pool_print_heatmap().
+ */
+
+#define TILE_SIZE 64
+
+// Draws the part of the frame at x, y, width x height
+typedef void (*tile_kernel)(int x, int y, int width, int height, void *data);
+
+struct tile_pool;
+
+struct tile_stats {
+	int tiles;
+	int steals;
+	uint64_t busy_ns;
+};
+
+// Draws with threads threads in total, including the caller. 0 for one per CPU.
+struct tile_pool *tile_pool_create(int threads);
+void tile_pool_destroy(struct tile_pool *pool);
+
+// Runs kernel over every tile of a width x height frame and waits for it to
+// finish. A NULL pool runs it on the calling thread over the whole frame.
+void tile_pool_run(struct tile_pool *pool, int width, int height,
+		tile_kernel kernel, void *data);
+
+int tile_pool_threads(struct tile_pool *pool);
+
+// Per-thread counters for the last frame, thread 0 being the caller
+void tile_pool_get_stats(struct tile_pool *pool, int thread, struct tile_stats *stats);
+
+// Cost of every tile in the last frame as a character grid, plus per-thread
+// counters
+void tile_pool_print_heatmap(struct tile_pool *pool, FILE *out);
+
+#endif
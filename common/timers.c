@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "timers.h"
+
+struct timer {
+	struct timer_heap *heap;
+
+	timer_func func;
+	void *data;
+
+	uint64_t deadline;
+	uint64_t interval;
+
+	// Position in heap->armed, -1 while disarmed
+	int index;
+
+	// Counters since the timer was added
+	uint64_t fires;
+	uint64_t overruns;
+
+	struct timer *prev, *next;
+};
+
+struct timer_heap {
+	int fd;
+	struct event_source *source;
+
+	// Binary min-heap on deadline
+	struct timer **armed;
+	int n_armed;
+	int max_armed;
+
+	// Deadline the timerfd is set to, 0 if disarmed
+	uint64_t programmed;
+
+	// All timers, armed or not
+	struct timer *timers;
+	int n_timers;
+
+	// Counters since the heap was created
+	uint64_t wakeups;
+	uint64_t fires;
+	uint64_t overruns;
+};
+
+uint64_t timer_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void heap_swap(struct timer_heap *heap, int a, int b)
+{
+	struct timer *t = heap->armed[a];
+	heap->armed[a] = heap->armed[b];
+	heap->armed[b] = t;
+
+	heap->armed[a]->index = a;
+	heap->armed[b]->index = b;
+}
+
+static void sift_up(struct timer_heap *heap, int i)
+{
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (heap->armed[parent]->deadline <= heap->armed[i]->deadline)
+			break;
+		heap_swap(heap, i, parent);
+		i = parent;
+	}
+}
+
+static void sift_down(struct timer_heap *heap, int i)
+{
+	for (;;) {
+		int smallest = i;
+		int left = 2 * i + 1;
+		int right = 2 * i + 2;
+
+		if (left < heap->n_armed &&
+				heap->armed[left]->deadline < heap->armed[smallest]->deadline)
+			smallest = left;
+		if (right < heap->n_armed &&
+				heap->armed[right]->deadline < heap->armed[smallest]->deadline)
+			smallest = right;
+
+		if (smallest == i)
+			break;
+		heap_swap(heap, i, smallest);
+		i = smallest;
+	}
+}
+
+static void heap_push(struct timer_heap *heap, struct timer *timer)
+{
+	if (heap->n_armed == heap->max_armed) {
+		heap->max_armed = heap->max_armed ? heap->max_armed * 2 : 16;
+		heap->armed = realloc(heap->armed, heap->max_armed * sizeof(*heap->armed));
+	}
+
+	timer->index = heap->n_armed++;
+	heap->armed[timer->index] = timer;
+	sift_up(heap, timer->index);
+}
+
+static void heap_remove(struct timer_heap *heap, struct timer *timer)
+{
+	int i = timer->index;
+	timer->index = -1;
+
+	if (i == --heap->n_armed)
+		return;
+
+	heap->armed[i] = heap->armed[heap->n_armed];
+	heap->armed[i]->index = i;
+	sift_up(heap, i);
+	sift_down(heap, heap->armed[i]->index);
+}
+
+// Point the timerfd at the earliest deadline, if that changed
+static void heap_program(struct timer_heap *heap)
+{
+	uint64_t deadline = heap->n_armed ? heap->armed[0]->deadline : 0;
+	if (deadline == heap->programmed)
+		return;
+
+	// An all-zero it_value would disarm instead
+	struct itimerspec its = {
+		.it_value = { deadline / NSEC_PER_SEC, deadline % NSEC_PER_SEC },
+	};
+	timerfd_settime(heap->fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	heap->programmed = deadline;
+}
+
+static void on_timerfd(int fd, uint32_t mask, void *data)
+{
+	struct timer_heap *heap = data;
+
+	uint64_t expirations;
+	read(fd, &expirations, sizeof(expirations));
+
+	// The fd fired, it has to be set again even for the same deadline
+	heap->programmed = 0;
+	heap->wakeups++;
+
+	const uint64_t now = timer_now_ns();
+
+	while (heap->n_armed && heap->armed[0]->deadline <= now) {
+		struct timer *timer = heap->armed[0];
+
+		if (timer->interval) {
+			timer->deadline += timer->interval;
+
+			if (timer->deadline <= now) {
+				uint64_t missed = (now - timer->deadline) / timer->interval + 1;
+				timer->deadline += missed * timer->interval;
+				timer->overruns += missed;
+				heap->overruns += missed;
+			}
+
+			sift_down(heap, 0);
+		} else
+			heap_remove(heap, timer);
+
+		timer->fires++;
+		heap->fires++;
+
+		// May rearm, disarm or destroy any timer, this one included
+		timer->func(timer->data);
+	}
+
+	heap_program(heap);
+}
+
+struct timer_heap *timer_heap_create(struct event_loop *loop)
+{
+	struct timer_heap *heap = calloc(1, sizeof(*heap));
+
+	heap->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (heap->fd < 0)
+		goto err;
+
+	heap->source = event_loop_add_fd(loop, heap->fd, EVENT_READABLE, on_timerfd, heap);
+	if (!heap->source)
+		goto err_fd;
+	event_source_set_name(heap->source, "timers");
+
+	return heap;
+
+err_fd:
+	close(heap->fd);
+err:
+	free(heap);
+	return NULL;
+}
+
+void timer_heap_destroy(struct timer_heap *heap)
+{
+	while (heap->timers)
+		timer_destroy(heap->timers);
+
+	event_source_remove(heap->source);
+	close(heap->fd);
+
+	free(heap->armed);
+	free(heap);
+}
+
+struct timer *timer_heap_add(struct timer_heap *heap, timer_func func, void *data)
+{
+	struct timer *timer = calloc(1, sizeof(*timer));
+	timer->heap = heap;
+	timer->func = func;
+	timer->data = data;
+	timer->index = -1;
+
+	timer->next = heap->timers;
+	if (heap->timers)
+		heap->timers->prev = timer;
+	heap->timers = timer;
+	heap->n_timers++;
+
+	return timer;
+}
+
+void timer_arm(struct timer *timer, uint64_t delay_ns, uint64_t interval_ns)
+{
+	struct timer_heap *heap = timer->heap;
+
+	timer->deadline = timer_now_ns() + delay_ns;
+	timer->interval = interval_ns;
+
+	if (timer->index < 0)
+		heap_push(heap, timer);
+	else {
+		sift_up(heap, timer->index);
+		sift_down(heap, timer->index);
+	}
+
+	heap_program(heap);
+}
+
+void timer_disarm(struct timer *timer)
+{
+	if (timer->index < 0)
+		return;
+
+	heap_remove(timer->heap, timer);
+	heap_program(timer->heap);
+}
+
+void timer_destroy(struct timer *timer)
+{
+	struct timer_heap *heap = timer->heap;
+
+	timer_disarm(timer);
+
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		heap->timers = timer->next;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	heap->n_timers--;
+
+	free(timer);
+}
+
+void timer_heap_print_stats(struct timer_heap *heap, FILE *out)
+{
+	fprintf(out, "timers: %d timers, %d armed, %lu wakeups, %lu fires, %lu overruns\n",
+			heap->n_timers, heap->n_armed, (unsigned long) heap->wakeups,
+			(unsigned long) heap->fires, (unsigned long) heap->overruns);
+}
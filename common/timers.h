@@ -0,0 +1,48 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "loop.h"
+
+/*
+ * Any number of timers on a single timerfd.
+ *
+ * Armed timers sit in a min-heap ordered by their absolute CLOCK_MONOTONIC
+ * deadline, and the timerfd is only ever set to the earliest one. Periodic
+ * timers advance from their previous deadline rather than from when they
+ * were dispatched, so a late wakeup doesn't push every later tick back. If a
+ * whole period or more was missed, those ticks are dropped and counted as
+ * overruns instead of firing in a burst.
+ */
+
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+typedef void (*timer_func)(void *data);
+
+struct timer_heap;
+struct timer;
+
+struct timer_heap *timer_heap_create(struct event_loop *loop);
+// Also destroys the heap's timers
+void timer_heap_destroy(struct timer_heap *heap);
+
+// Disarmed until timer_arm()
+struct timer *timer_heap_add(struct timer_heap *heap, timer_func func, void *data);
+
+// Fires after delay_ns, then every interval_ns if that's not 0. Rearming an
+// armed timer moves it.
+void timer_arm(struct timer *timer, uint64_t delay_ns, uint64_t interval_ns);
+void timer_disarm(struct timer *timer);
+
+// Safe to call from the timer's own callback
+void timer_destroy(struct timer *timer);
+
+// CLOCK_MONOTONIC, what deadlines are measured against
+uint64_t timer_now_ns();
+
+void timer_heap_print_stats(struct timer_heap *heap, FILE *out);
+
+#endif
@@ -5,6 +5,7 @@
 
 struct buffer {
 	struct wl_buffer *wl_buffer;
+	struct shm_block *block;
 	void *data;
 	size_t size;
 	int busy;
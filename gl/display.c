@@ -4,6 +4,7 @@
 #include <wayland-client.h>
 #include <EGL/egl.h>
 
+#include "../common/pool.h"
 #include "../protocols/xdg-shell.h"
 
 #include "display.h"
@@ -74,6 +75,8 @@ struct display *create_display()
 	wl_registry_add_listener(display->wl_registry, &wl_registry_listener, display);
 	wl_display_roundtrip(display->wl_display);
 
+	display->shm_pool = shm_pool_create(display->wl_shm, 0);
+
 	init_egl(display);
 
 	return display;
@@ -86,6 +89,9 @@ void destroy_display(struct display* display)
 	if (display->xdg_wm_base)
 		xdg_wm_base_destroy(display->xdg_wm_base);
 
+	if (display->shm_pool)
+		shm_pool_destroy(display->shm_pool);
+
 	if (display->wl_shm)
 		wl_shm_destroy(display->wl_shm);
 
@@ -9,6 +9,9 @@ struct display {
 	struct wl_seat *wl_seat;
 	struct xdg_wm_base *xdg_wm_base;
 
+	// Backing memory for all buffers
+	struct shm_pool *shm_pool;
+
 	// EGL
 	void *egl_display;
 	void *egl_config;
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
@@ -14,11 +15,48 @@
 #include "../protocols/xdg-decoration-unstable-v1.h"
 #include "../protocols/xdg-shell.h"
 
-struct buffer {
-	struct wl_buffer *wl_buffer;
-	uint32_t *pixels;
-	pixman_image_t *pixman_image;
-	int size;
+#include "cache.h"
+#include "log.h"
+#include "shm.h"
+
+// Released buffers kept around for reuse
+const size_t BUFFER_CACHE_MAX_BYTES = 64 * 1024 * 1024;
+
+#define IMAGE_CACHE_SIZE 8
+#define MAX_GRADIENT_STOPS 4
+
+// Everything a linear gradient is built from. Compared with memcmp, so always
+// memset before filling in.
+struct image_key {
+	pixman_point_fixed_t p1, p2;
+	pixman_gradient_stop_t stops[MAX_GRADIENT_STOPS];
+	int n_stops;
+
+	// Area the gradient gets composited over
+	int width, height;
+};
+
+struct cached_image {
+	struct image_key key;
+	pixman_image_t *source;
+
+	// The gradient rendered into plain pixels, made once the same geometry
+	// comes up a second time so one-off sizes during a resize don't pay for it
+	pixman_image_t *raster;
+
+	unsigned int last_used;
+};
+
+// Gradients kept across frames, least recently used ones go first. Solid
+// fills are cheap to create and change every frame, so they aren't cached.
+struct image_cache {
+	struct cached_image entries[IMAGE_CACHE_SIZE];
+	int n;
+	unsigned int clock;
+
+	int hits;
+	int misses;
+	int rasters;
 };
 
 struct app_state {
@@ -44,6 +82,11 @@ struct app_state {
 	// App state
 	bool running;
 
+	// SHM_* flags for new buffers
+	int shm_flags;
+	struct buffer_cache buffer_cache;
+	struct image_cache image_cache;
+
 	int width;
 	int height;
 };
@@ -93,43 +136,90 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = noop,
 };
 
-static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+static void buffer_destroy(struct cached_buffer *buffer)
 {
-	struct buffer *buffer = data;
+	pixman_image_unref(buffer->data);
+}
+
+static struct cached_buffer *get_buffer(struct app_state *app, int width, int height)
+{
+	struct cached_buffer *buffer = buffer_cache_get(&app->buffer_cache, width,
+			height, WL_SHM_FORMAT_ARGB8888);
+	if (!buffer)
+		return NULL;
+
+	// The pixman wrapper is recycled along with the buffer
+	if (!buffer->data)
+		buffer->data = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+				width, height, buffer->pixels, buffer->stride);
 
-	wl_buffer_destroy(buffer->wl_buffer);
-	pixman_image_unref(buffer->pixman_image);
-	munmap(buffer->pixels, buffer->size);
-	free(buffer);
+	return buffer;
 }
 
-static const struct wl_buffer_listener wl_buffer_listener = {
-	.release = wl_buffer_release,
-};
+static void cached_image_clear(struct cached_image *entry)
+{
+	pixman_image_unref(entry->source);
+	if (entry->raster)
+		pixman_image_unref(entry->raster);
+}
 
-struct buffer *create_buffer(struct app_state *app, int width, int height)
+static void image_cache_finish(struct image_cache *cache)
 {
-	int size = width * height * 4;
-	int stride = width * 4;
+	for (int i = 0; i < cache->n; i++)
+		cached_image_clear(&cache->entries[i]);
 
-	int fd = memfd_create("buffer-pool", 0);
-	ftruncate(fd, size);
+	cache->n = 0;
+}
 
-	struct wl_shm_pool *wl_shm_pool = wl_shm_create_pool(app->wl_shm, fd, size);
+static struct cached_image *image_cache_get(struct image_cache *cache,
+		const struct image_key *key)
+{
+	cache->clock++;
+
+	for (int i = 0; i < cache->n; i++) {
+		struct cached_image *entry = &cache->entries[i];
+		if (memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			entry->last_used = cache->clock;
+			cache->hits++;
+
+			// Second time around, render the gradient once for good
+			if (!entry->raster) {
+				entry->raster = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						key->width, key->height, NULL, 0);
+				pixman_image_composite32(PIXMAN_OP_SRC, entry->source, NULL,
+						entry->raster, 0, 0, 0, 0, 0, 0, key->width, key->height);
+				cache->rasters++;
+			}
+
+			return entry;
+		}
+	}
+
+	cache->misses++;
+
+	struct cached_image *entry;
+	if (cache->n < IMAGE_CACHE_SIZE) {
+		entry = &cache->entries[cache->n++];
+	} else {
+		entry = &cache->entries[0];
+		for (int i = 1; i < cache->n; i++) {
+			if (cache->entries[i].last_used < entry->last_used)
+				entry = &cache->entries[i];
+		}
+		cached_image_clear(entry);
+	}
 
-	struct buffer *buffer = calloc(1, sizeof(*buffer));
-	buffer->size = size;
-	buffer->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	buffer->pixman_image = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
-			width, height, buffer->pixels, stride);
-	buffer->wl_buffer = wl_shm_pool_create_buffer(wl_shm_pool, 0, width, height,
-			stride, WL_SHM_FORMAT_ARGB8888);
-	wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+	*entry = (struct cached_image){ .key = *key, .last_used = cache->clock };
+	entry->source = pixman_image_create_linear_gradient(&key->p1, &key->p2,
+			key->stops, key->n_stops);
 
-	wl_shm_pool_destroy(wl_shm_pool);
-	close(fd);
+	return entry;
+}
 
-	return buffer;
+// The cheapest image that composites the same as entry's source
+static pixman_image_t *cached_image_source(struct cached_image *entry)
+{
+	return entry->raster ? entry->raster : entry->source;
 }
 
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
@@ -139,7 +229,19 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 
 	xdg_surface_ack_configure(xdg_surface, serial);
 
-	struct buffer *buffer = create_buffer(app, app->width, app->height);
+	struct cached_buffer *buffer = get_buffer(app, app->width, app->height);
+	if (!buffer) {
+		LOG("No buffer for %dx%d, skipping frame", app->width, app->height);
+		return;
+	}
+
+	uint32_t *pixels = buffer->pixels;
+	LOG("Buffer cache: %d hits, %d misses, %d evictions", app->buffer_cache.hits,
+			app->buffer_cache.misses, app->buffer_cache.evictions);
+
+	// Faults taken while drawing, --prefault moves them into buffer_cache_get()
+	struct rusage usage_start;
+	getrusage(RUSAGE_SELF, &usage_start);
 
 	// Fill xor pattern by hand
 	for (int y = 0; y < app->height; y++) {
@@ -148,34 +250,42 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 			uint8_t g = x ^ y;
 			uint8_t b = x ^ y;
 			uint8_t a = 0x7f;
-			buffer->pixels[y * app->width + x] = (a << 24) + (r << 16) +
+			pixels[y * app->width + x] = (a << 24) + (r << 16) +
 												 (g << 8) + b;
 		}
 	}
 
 	// Left half solid fill
-	pixman_image_t *fill_img = pixman_image_create_solid_fill(
-			&((pixman_color_t){
-				.red = random() & 0x7fff,
-				.green = random() & 0x7fff,
-				.blue = random() & 0x7fff,
-				.alpha = 0xffff,
-			}));
-	pixman_image_composite(PIXMAN_OP_COLOR_BURN, fill_img, NULL, buffer->pixman_image,
-			0, 0, 0, 0, 0, 0, app->width / 2, app->height);
-	pixman_image_unref(fill_img);
+	pixman_color_t color = {
+		.red = random() & 0x7fff,
+		.green = random() & 0x7fff,
+		.blue = random() & 0x7fff,
+		.alpha = 0xffff,
+	};
+	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
+	pixman_image_composite(PIXMAN_OP_COLOR_BURN, fill, NULL,
+			buffer->data, 0, 0, 0, 0, 0, 0, app->width / 2, app->height);
+	pixman_image_unref(fill);
 
 	// Right half gradient	
-	pixman_point_fixed_t p1 = { 0, 0 };
-	pixman_point_fixed_t p2 = { pixman_int_to_fixed(app->width / 2), pixman_int_to_fixed(app->height) };
-	pixman_gradient_stop_t stops[] = {
-		{ .x = pixman_int_to_fixed(0), .color = { 0xffff, 0x0000, 0xffff, 0xffff } },
-		{ .x = pixman_int_to_fixed(1), .color = { 0x0000, 0xffff, 0xffff, 0xffff } },
-	};
-	pixman_image_t *gradient_img = pixman_image_create_linear_gradient(&p1, &p2, stops, 2);
-	pixman_image_composite(PIXMAN_OP_SATURATE, gradient_img, NULL, buffer->pixman_image,
-			0, 0, 0, 0, app->width / 2, 0, app->width / 2, app->height);
-	pixman_image_unref(gradient_img);
+	struct image_key key;
+	memset(&key, 0, sizeof(key));
+	key.p1 = (pixman_point_fixed_t){ 0, 0 };
+	key.p2 = (pixman_point_fixed_t){ pixman_int_to_fixed(app->width / 2), pixman_int_to_fixed(app->height) };
+	key.stops[0] = (pixman_gradient_stop_t){ .x = pixman_int_to_fixed(0), .color = { 0xffff, 0x0000, 0xffff, 0xffff } };
+	key.stops[1] = (pixman_gradient_stop_t){ .x = pixman_int_to_fixed(1), .color = { 0x0000, 0xffff, 0xffff, 0xffff } };
+	key.n_stops = 2;
+	key.width = app->width / 2;
+	key.height = app->height;
+	struct cached_image *gradient = image_cache_get(&app->image_cache, &key);
+	pixman_image_composite(PIXMAN_OP_SATURATE, cached_image_source(gradient), NULL,
+			buffer->data, 0, 0, 0, 0, app->width / 2, 0, app->width / 2, app->height);
+
+	struct rusage usage_end;
+	getrusage(RUSAGE_SELF, &usage_end);
+	LOG("Draw: %ld minor, %ld major faults",
+			usage_end.ru_minflt - usage_start.ru_minflt,
+			usage_end.ru_majflt - usage_start.ru_majflt);
 
 	wl_surface_attach(app->wl_surface, buffer->wl_buffer, 0, 0);
 	wl_surface_commit(app->wl_surface);
@@ -220,6 +330,10 @@ void app_init(struct app_state *app)
 			app->wp_viewporter && app->wp_single_pixel_buffer_manager_v1 &&
 			app->zxdg_decoration_manager_v1);
 
+	buffer_cache_init(&app->buffer_cache, app->wl_shm, BUFFER_CACHE_MAX_BYTES,
+			buffer_destroy);
+	app->buffer_cache.shm_flags = app->shm_flags;
+
 	// Set up surface
 	app->wl_surface = wl_compositor_create_surface(app->wl_compositor);
 
@@ -252,11 +366,28 @@ int main(int argc, char *argv[])
 		.height = 256,
 	};
 
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--prefault") == 0)
+			app.shm_flags |= SHM_POPULATE;
+		else if (strcmp(argv[i], "--mlock") == 0)
+			app.shm_flags |= SHM_LOCK;
+	}
+
 	app_init(&app);
 
 	// Main loop
 	while (wl_display_dispatch(app.wl_display) != -1 && app.running) {
 	}
 
+	fprintf(stderr, "Buffer cache: %d hits, %d misses, %d evictions\n",
+			app.buffer_cache.hits, app.buffer_cache.misses,
+			app.buffer_cache.evictions);
+	fprintf(stderr, "Image cache: %d hits, %d misses, %d gradients rasterized\n",
+			app.image_cache.hits, app.image_cache.misses,
+			app.image_cache.rasters);
+
+	image_cache_finish(&app.image_cache);
+	buffer_cache_finish(&app.buffer_cache);
+
 	return 0;
 }
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
@@ -13,13 +14,66 @@
 #include "../protocols/xdg-decoration-unstable-v1.h"
 #include "../protocols/xdg-shell.h"
 
-const int MAX_WIDTH = 1000;
-const int MAX_HEIGHT = 1000;
+#include "premultiply.h"
+#include "shm.h"
+
+struct app_state;
+
+// One of the two regions of the pool frames alternate between, so we never
+// draw into memory the compositor may still be reading
+struct slot {
+	struct app_state *app;
+
+	size_t offset;
+	size_t size;
+
+	// Bytes used by the last wl_buffer made from it, and the most ever
+	// written since it was last reclaimed
+	size_t used;
+	size_t touched;
+
+	// wl_buffers not yet released by the compositor
+	int outstanding;
+};
 
 struct buffer {
 	int fd;
 	struct wl_shm_pool *wl_shm_pool;
-	uint32_t *pixels;
+	uint8_t *pixels;
+	size_t size;
+
+	// Number of times the pool was grown and remapped
+	int remaps;
+
+	struct slot slots[2];
+};
+
+// Frame time the governor aims for
+const double FRAME_BUDGET_MS = 1000.0 / 60;
+
+// Render scale limits and step
+const double GOVERNOR_MIN_SCALE = 0.25;
+const double GOVERNOR_STEP = 0.85;
+
+/*
+ * Picks the render resolution from how long drawing takes.
+ *
+ * Drawing over 90% of the budget for a few frames in a row drops the scale a
+ * step. It only goes back up after many frames well under budget, and only if
+ * the bigger frame is predicted to still fit. Draw time follows the pixel
+ * count, i.e. the square of the scale, so the prediction is cheap and keeps
+ * the two thresholds from chasing each other.
+ */
+struct governor {
+	bool enabled;
+
+	double scale;
+	double avg_ms;
+
+	int over;
+	int under;
+
+	int changes;
 };
 
 struct app_state {
@@ -43,8 +97,21 @@ struct app_state {
 	struct buffer buffer;
 	struct wp_viewport *wp_viewport;
 
+	// Set with --governor, redraws every frame and scales the render size
+	struct governor governor;
+	bool frame_pending;
+	uint32_t time;
+
+	// Both slots were busy when a frame was due, draw once one is released
+	bool draw_pending;
+
+	// Set with --work N, draws every frame N times to simulate a heavy scene
+	int work;
+
 	// App state
 	bool running;
+	bool resizing;
+	bool suspended;
 
 	int width;
 	int height;
@@ -70,7 +137,7 @@ static void registry_global(void *data, struct wl_registry *registry,
 
 	else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
 		app->xdg_wm_base =
-				wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+				wl_registry_bind(registry, name, &xdg_wm_base_interface, MIN(version, 6));
 	}
 
 	else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
@@ -95,37 +162,263 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = noop,
 };
 
+static size_t buffer_touched(struct buffer *buffer)
+{
+	return buffer->slots[0].touched + buffer->slots[1].touched;
+}
+
+static void slot_reclaim(struct buffer *buffer, struct slot *slot, size_t keep)
+{
+	if (slot->touched <= keep)
+		return;
+
+	punch_shm_file(buffer->fd, slot->offset + keep, slot->touched - keep);
+	slot->touched = keep;
+}
+
+// Drops what's beyond each slot's last frame, or everything if all is false
+static void buffer_reclaim(struct buffer *buffer, bool all)
+{
+	size_t touched = buffer_touched(buffer);
+	size_t rss = 0;
+
+	for (int i = 0; i < 2; i++) {
+		struct slot *slot = &buffer->slots[i];
+		size_t keep = all ? 0 : slot->used;
+
+		// Reading /proc isn't free, only do it if there's something to punch
+		if (slot->touched > keep && !rss)
+			rss = get_rss();
+
+		slot_reclaim(buffer, slot, keep);
+	}
+
+	if (buffer_touched(buffer) < touched)
+		fprintf(stderr, "Reclaimed %zu pool bytes, RSS %zu -> %zu KiB\n",
+				touched - buffer_touched(buffer), rss / 1024, get_rss() / 1024);
+}
+
+static void draw(struct app_state *app);
+
 static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
+	struct slot *slot = data;
+	struct app_state *app = slot->app;
+	struct buffer *buffer = &app->buffer;
+
 	wl_buffer_destroy(wl_buffer);
+	slot->outstanding--;
+
+	// Once the compositor is done with a slot, only the bytes of its last
+	// frame need to stay resident. While suspended nothing has to.
+	bool idle = buffer->slots[0].outstanding == 0 && buffer->slots[1].outstanding == 0;
+	buffer_reclaim(buffer, idle && app->suspended);
+
+	if (app->draw_pending && !app->suspended) {
+		app->draw_pending = false;
+		draw(app);
+	}
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
 	.release = wl_buffer_release,
 };
 
-static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
-		uint32_t serial)
+static void buffer_grow(struct app_state *app, struct buffer *buffer, size_t size)
 {
-	struct app_state *app = data;
+	if (size <= buffer->size)
+		return;
+
+	// Grow geometrically so a resize drag only remaps a handful of times.
+	// wl_shm_pool can only ever grow, which is all we need here.
+	size_t new_size = buffer->size;
+	while (new_size < size)
+		new_size *= 2;
+
+	ftruncate(buffer->fd, new_size);
+	wl_shm_pool_resize(buffer->wl_shm_pool, new_size);
+
+	munmap(buffer->pixels, buffer->size);
+	buffer->pixels = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+	buffer->size = new_size;
+	buffer->remaps++;
+}
 
-	xdg_surface_ack_configure(xdg_surface, serial);
+// A released slot with room for size bytes, NULL if both are still in use
+static struct slot *buffer_get_slot(struct app_state *app, struct buffer *buffer, size_t size)
+{
+	struct slot *slot = &buffer->slots[0];
+	struct slot *other = &buffer->slots[1];
+	if (slot->outstanding) {
+		slot = &buffer->slots[1];
+		other = &buffer->slots[0];
+	}
+	if (slot->outstanding)
+		return NULL;
+
+	if (slot->size < size) {
+		// Slots grow geometrically too. An idle other slot only holds an
+		// old frame, so both start over from the front of the pool.
+		size_t slot_size = MAX(slot->size, 4096);
+		while (slot_size < size)
+			slot_size *= 2;
+
+		slot_reclaim(buffer, slot, 0);
+		if (!other->outstanding) {
+			slot_reclaim(buffer, other, 0);
+			slot->offset = 0;
+			other->offset = slot_size;
+			other->size = other->used = 0;
+		} else if (slot->offset < other->offset)
+			slot->offset = other->offset + other->size;
+
+		slot->size = slot_size;
+		buffer_grow(app, buffer, slot->offset + slot->size);
+	}
+
+	return slot;
+}
+
+static double now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void governor_init(struct governor *governor)
+{
+	*governor = (struct governor){ .enabled = true, .scale = 1 };
+}
+
+static void governor_update(struct governor *governor, double draw_ms)
+{
+	// Smooth out single slow frames
+	governor->avg_ms = governor->avg_ms ? 0.8 * governor->avg_ms + 0.2 * draw_ms : draw_ms;
+
+	governor->over = governor->avg_ms > 0.9 * FRAME_BUDGET_MS ? governor->over + 1 : 0;
+	governor->under = governor->avg_ms < 0.6 * FRAME_BUDGET_MS ? governor->under + 1 : 0;
+
+	double scale = governor->scale;
+
+	if (governor->over >= 3)
+		scale = MAX(scale * GOVERNOR_STEP, GOVERNOR_MIN_SCALE);
+
+	if (governor->under >= 60) {
+		double up = MIN(scale / GOVERNOR_STEP, 1);
+		double predicted = governor->avg_ms * (up * up) / (scale * scale);
+		if (predicted < 0.75 * FRAME_BUDGET_MS)
+			scale = up;
+	}
+
+	if (scale == governor->scale)
+		return;
+
+	// The new size needs a fresh measurement
+	governor->avg_ms *= (scale * scale) / (governor->scale * governor->scale);
+	governor->over = 0;
+	governor->under = 0;
+	governor->scale = scale;
+	governor->changes++;
+
+	fprintf(stderr, "Governor: %.2f ms per draw, render scale %.2f\n",
+			governor->avg_ms, scale);
+}
+
+static void frame_done(void *data, struct wl_callback *wl_callback, uint32_t time);
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void draw(struct app_state *app)
+{
+	// Render below native size when the governor says so, the viewport
+	// scales it back up to the window
+	double scale = app->governor.enabled ? app->governor.scale : 1;
+	int width = MAX(1, (int) (app->width * scale));
+	int height = MAX(1, (int) (app->height * scale));
+
+	// Growing the pool if the window got bigger. The slot is sized for the
+	// governor's render size, not the window's.
+	struct slot *slot = buffer_get_slot(app, &app->buffer, width * height * 4);
+	if (!slot) {
+		app->draw_pending = true;
+		return;
+	}
+
+	uint32_t *pixels = (uint32_t *) (app->buffer.pixels + slot->offset);
+
+	double start = now_ms();
+
+	// Offset by time, so there's something to redraw every frame
+	int offset = app->governor.enabled ? app->time / 16 : 0;
+
+	for (int i = 0; i < MAX(app->work, 1); i++) {
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				uint8_t r = (x + offset) ^ y;
+				uint8_t g = (x + offset) ^ y;
+				uint8_t b = (x + offset) ^ y;
+				uint8_t a = 0x7f;
+				pixels[y * width + x] = (a << 24) + (r << 16) + (g << 8) + b;
+			}
+		}
+	}
+
+	// wl_shm wants ARGB8888 premultiplied
+	premultiply_argb8888(pixels, width * 4, 0, 0, width, height);
+
+	if (app->governor.enabled)
+		governor_update(&app->governor, now_ms() - start);
 
-	// Buffer can't exceed MAX_WIDTH * MAX_HEIGHT * 4
-	int buf_width = MIN(app->width, MAX_WIDTH);
-	int buf_height = MIN(app->height, MAX_HEIGHT);
 	struct wl_buffer *wl_buffer =
-			wl_shm_pool_create_buffer(app->buffer.wl_shm_pool, 0, buf_width,
-					buf_height, buf_width * 4, WL_SHM_FORMAT_ARGB8888);
-	wl_buffer_add_listener(wl_buffer, &wl_buffer_listener, NULL);
+			wl_shm_pool_create_buffer(app->buffer.wl_shm_pool, slot->offset, width,
+					height, width * 4, WL_SHM_FORMAT_ARGB8888);
+	wl_buffer_add_listener(wl_buffer, &wl_buffer_listener, slot);
 	wl_surface_attach(app->wl_surface, wl_buffer, 0, 0);
+	wl_surface_damage_buffer(app->wl_surface, 0, 0, width, height);
 
-	// Anything above is scaled via wp_viewport
-	wp_viewport_set_destination(app->wp_viewport, app->width, app->height);
+	if (width != app->width || height != app->height)
+		wp_viewport_set_destination(app->wp_viewport, app->width, app->height);
+	else
+		wp_viewport_set_destination(app->wp_viewport, -1, -1);
 
+	if (app->governor.enabled && !app->frame_pending) {
+		struct wl_callback *wl_callback = wl_surface_frame(app->wl_surface);
+		wl_callback_add_listener(wl_callback, &frame_listener, app);
+		app->frame_pending = true;
+	}
+
+	slot->used = width * height * 4;
+	slot->touched = MAX(slot->touched, slot->used);
+	slot->outstanding++;
 	wl_surface_commit(app->wl_surface);
 }
 
+static void frame_done(void *data, struct wl_callback *wl_callback, uint32_t time)
+{
+	struct app_state *app = data;
+
+	wl_callback_destroy(wl_callback);
+	app->frame_pending = false;
+	app->time = time;
+
+	if (!app->suspended)
+		draw(app);
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+		uint32_t serial)
+{
+	struct app_state *app = data;
+
+	xdg_surface_ack_configure(xdg_surface, serial);
+
+	draw(app);
+}
+
 static const struct xdg_surface_listener xdg_surface_listener = {
 	.configure = xdg_surface_configure,
 };
@@ -138,6 +431,31 @@ static void xdg_toplevel_configure(void *data,
 
 	if (width > 0) app->width = width;
 	if (height > 0) app->height = height;
+
+	bool resizing = false;
+	bool suspended = false;
+	uint32_t *state;
+	wl_array_for_each(state, states) {
+		if (*state == XDG_TOPLEVEL_STATE_RESIZING)
+			resizing = true;
+		else if (*state == XDG_TOPLEVEL_STATE_SUSPENDED)
+			suspended = true;
+	}
+
+	// Hidden and the compositor is done with our memory, drop all of it
+	if (suspended && !app->suspended && app->buffer.slots[0].outstanding == 0 &&
+			app->buffer.slots[1].outstanding == 0)
+		buffer_reclaim(&app->buffer, true);
+
+	app->suspended = suspended;
+
+	if (resizing && !app->resizing)
+		app->buffer.remaps = 0;
+	else if (!resizing && app->resizing)
+		fprintf(stderr, "Resize drag: %d remaps, pool is %zu bytes\n",
+				app->buffer.remaps, app->buffer.size);
+
+	app->resizing = resizing;
 }
 
 void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
@@ -192,25 +510,23 @@ void app_init(struct app_state *app)
 
 void buffer_init(struct app_state *app, struct buffer *buffer)
 {
-	const size_t mem_size = MAX_WIDTH * MAX_HEIGHT * 4;
-
-	int fd = memfd_create("buffer-pool", 0);
-	ftruncate(fd, mem_size);
-
-	buffer->wl_shm_pool = wl_shm_create_pool(app->wl_shm, fd, mem_size);
-	buffer->pixels = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-	for (int y = 0; y < MAX_HEIGHT; y++) {
-		for (int x = 0; x < MAX_WIDTH; x++) {
-			uint8_t r = x ^ y;
-			uint8_t g = x ^ y;
-			uint8_t b = x ^ y;
-			uint8_t a = 0x7f;
-			buffer->pixels[y * MAX_WIDTH + x] = (a << 24) + (r << 16) + (g << 8) + b; 
-		}
+	// Two frames of the initial window, grown on demand in buffer_grow()
+	const size_t mem_size = 2 * app->width * app->height * 4;
+
+	buffer->fd = memfd_create("buffer-pool", 0);
+	ftruncate(buffer->fd, mem_size);
+
+	buffer->wl_shm_pool = wl_shm_create_pool(app->wl_shm, buffer->fd, mem_size);
+	buffer->pixels = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+	buffer->size = mem_size;
+
+	for (int i = 0; i < 2; i++) {
+		buffer->slots[i] = (struct slot){
+			.app = app,
+			.offset = i * mem_size / 2,
+			.size = mem_size / 2,
+		};
 	}
-
-	close(fd);
 }
 
 int main(int argc, char *argv[])
@@ -221,6 +537,13 @@ int main(int argc, char *argv[])
 		.height = 256,
 	};
 
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--governor") == 0)
+			governor_init(&app.governor);
+		else if (strcmp(argv[i], "--work") == 0 && i + 1 < argc)
+			app.work = atoi(argv[++i]);
+	}
+
 	app_init(&app);
 	buffer_init(&app, &app.buffer);
 
@@ -228,5 +551,10 @@ int main(int argc, char *argv[])
 	while (wl_display_dispatch(app.wl_display) != -1 && app.running) {
 	}
 
+	if (app.governor.enabled)
+		fprintf(stderr, "Governor: %d scale changes, ended at %.2f, slots of %zu and %zu bytes\n",
+				app.governor.changes, app.governor.scale,
+				app.buffer.slots[0].size, app.buffer.slots[1].size);
+
 	return 0;
 }
@@ -13,12 +13,35 @@
 #include "../protocols/xdg-decoration-unstable-v1.h"
 #include "../protocols/xdg-shell.h"
 
+#include "premultiply.h"
+
 struct buffer {
 	struct wl_buffer *wl_buffer;
 	uint32_t *pixels;
 	int size;
 };
 
+struct app_state;
+
+// Memory reused for every frame of an interactive resize, sized to the
+// largest configure seen during the drag
+struct resize_buffer {
+	struct app_state *app;
+
+	int fd;
+	struct wl_shm_pool *wl_shm_pool;
+	uint32_t *pixels;
+	int size;
+
+	bool busy;
+};
+
+// Two of them, since compositors tend to hold on to the attached buffer
+// until the next one replaces it
+struct resize_pool {
+	struct resize_buffer buffers[2];
+};
+
 struct app_state {
 	// Wayland globals
 	struct wl_display *wl_display;
@@ -38,12 +61,23 @@ struct app_state {
 
 	// Surface content & transform
 	struct wp_viewport *wp_viewport;
+	struct resize_pool resize_pool;
 
 	// App state
 	bool running;
+	bool resizing;
+
+	// Configure received since the last frame was drawn
+	bool dirty;
+	bool frame_pending;
 
 	int width;
 	int height;
+
+	// Per-drag counters
+	int configures;
+	int frames;
+	int allocations;
 };
 
 static void noop() {}
@@ -127,26 +161,150 @@ struct buffer *create_buffer(struct app_state *app, int width, int height)
 	return buffer;
 }
 
-static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
-		uint32_t serial)
+static void resize_buffer_destroy(struct resize_buffer *buffer)
+{
+	if (!buffer->wl_shm_pool)
+		return;
+
+	wl_shm_pool_destroy(buffer->wl_shm_pool);
+	munmap(buffer->pixels, buffer->size);
+	close(buffer->fd);
+
+	*buffer = (struct resize_buffer){ .app = buffer->app };
+}
+
+// Buffers the compositor still holds go once they're released
+static void resize_pool_destroy(struct resize_pool *pool)
+{
+	for (int i = 0; i < 2; i++) {
+		if (!pool->buffers[i].busy)
+			resize_buffer_destroy(&pool->buffers[i]);
+	}
+}
+
+static void resize_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct resize_buffer *buffer = data;
+
+	wl_buffer_destroy(wl_buffer);
+	buffer->busy = false;
+
+	if (!buffer->app->resizing)
+		resize_buffer_destroy(buffer);
+}
+
+static const struct wl_buffer_listener resize_buffer_listener = {
+	.release = resize_buffer_release,
+};
+
+// Returns NULL if both buffers are still held by the compositor
+static struct wl_buffer *resize_pool_get_buffer(struct app_state *app,
+		int width, int height, uint32_t **pixels)
+{
+	struct resize_buffer *buffer = &app->resize_pool.buffers[0];
+	if (buffer->busy) buffer = &app->resize_pool.buffers[1];
+	if (buffer->busy) return NULL;
+
+	int size = width * height * 4;
+
+	buffer->app = app;
+
+	if (!buffer->wl_shm_pool) {
+		buffer->fd = memfd_create("resize-pool", 0);
+		ftruncate(buffer->fd, size);
+		buffer->wl_shm_pool = wl_shm_create_pool(app->wl_shm, buffer->fd, size);
+		buffer->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+		buffer->size = size;
+		app->allocations++;
+	} else if (buffer->size < size) {
+		ftruncate(buffer->fd, size);
+		wl_shm_pool_resize(buffer->wl_shm_pool, size);
+		munmap(buffer->pixels, buffer->size);
+		buffer->pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+		buffer->size = size;
+		app->allocations++;
+	}
+
+	struct wl_buffer *wl_buffer = wl_shm_pool_create_buffer(buffer->wl_shm_pool, 0,
+			width, height, width * 4, WL_SHM_FORMAT_ARGB8888);
+	wl_buffer_add_listener(wl_buffer, &resize_buffer_listener, buffer);
+	buffer->busy = true;
+
+	*pixels = buffer->pixels;
+	return wl_buffer;
+}
+
+static void draw(struct app_state *app);
+
+static void frame_done(void *data, struct wl_callback *wl_callback, uint32_t time)
 {
 	struct app_state *app = data;
 
-	xdg_surface_ack_configure(xdg_surface, serial);
+	wl_callback_destroy(wl_callback);
+	app->frame_pending = false;
+
+	if (app->dirty)
+		draw(app);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void draw(struct app_state *app)
+{
+	struct wl_buffer *wl_buffer = NULL;
+	uint32_t *pixels;
+
+	if (app->resizing)
+		wl_buffer = resize_pool_get_buffer(app, app->width, app->height, &pixels);
+
+	if (!wl_buffer) {
+		struct buffer *buffer = create_buffer(app, app->width, app->height);
+		wl_buffer = buffer->wl_buffer;
+		pixels = buffer->pixels;
+		app->allocations++;
+	}
 
-	struct buffer *buffer = create_buffer(app, app->width, app->height);
 	for (int y = 0; y < app->height; y++) {
 		for (int x = 0; x < app->width; x++) {
 			uint8_t r = x ^ y;
 			uint8_t g = x ^ y;
 			uint8_t b = x ^ y;
 			uint8_t a = 0x7f;
-			buffer->pixels[y * app->width + x] = (a << 24) + (r << 16) + (g << 8) + b; 
+			pixels[y * app->width + x] = (a << 24) + (r << 16) + (g << 8) + b;
 		}
 	}
 
-	wl_surface_attach(app->wl_surface, buffer->wl_buffer, 0, 0);
+	// wl_shm wants ARGB8888 premultiplied
+	premultiply_argb8888(pixels, app->width * 4, 0, 0, app->width, app->height);
+
+	struct wl_callback *wl_callback = wl_surface_frame(app->wl_surface);
+	wl_callback_add_listener(wl_callback, &frame_listener, app);
+	app->frame_pending = true;
+
+	wl_surface_attach(app->wl_surface, wl_buffer, 0, 0);
+	wl_surface_damage_buffer(app->wl_surface, 0, 0, app->width, app->height);
 	wl_surface_commit(app->wl_surface);
+
+	app->dirty = false;
+	app->frames++;
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+		uint32_t serial)
+{
+	struct app_state *app = data;
+
+	// Every serial is acked, but only the newest size gets drawn: while a
+	// frame is in flight further configures just overwrite app->width/height
+	xdg_surface_ack_configure(xdg_surface, serial);
+
+	app->dirty = true;
+	app->configures++;
+
+	if (!app->frame_pending)
+		draw(app);
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -161,6 +319,26 @@ static void xdg_toplevel_configure(void *data,
 
 	if (width > 0) app->width = width;
 	if (height > 0) app->height = height;
+
+	bool resizing = false;
+	uint32_t *state;
+	wl_array_for_each(state, states) {
+		if (*state == XDG_TOPLEVEL_STATE_RESIZING)
+			resizing = true;
+	}
+
+	if (resizing && !app->resizing) {
+		app->configures = 0;
+		app->frames = 0;
+		app->allocations = 0;
+	} else if (!resizing && app->resizing) {
+		fprintf(stderr, "Resize drag: %d configures, %d frames, %d allocations\n",
+				app->configures, app->frames, app->allocations);
+
+		resize_pool_destroy(&app->resize_pool);
+	}
+
+	app->resizing = resizing;
 }
 
 void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
@@ -1,11 +1,10 @@
 #include <assert.h>
-#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
-#include <sys/timerfd.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
@@ -15,6 +14,7 @@
 
 #include "app.h"
 #include "log.h"
+#include "loop.h"
 
 static struct {
 	struct wl_display *wl_display;
@@ -221,27 +221,41 @@ void app_init(int width, int height,
 	wl_keyboard_add_listener(wl_keyboard, &wl_keyboard_listener, NULL);
 }
 
+static void on_wayland(int fd, uint32_t mask, void *data)
+{
+	if (wl_display_dispatch(globals.wl_display) < 0)
+		app_stop();
+}
+
+static void on_signal(int signal, void *data)
+{
+	app_stop();
+}
+
 void app_run()
 {
-	enum {
-		WAYLAND,
-	};
+	struct event_loop *loop = event_loop_create();
+
+	struct event_source *source = event_loop_add_fd(loop,
+			wl_display_get_fd(globals.wl_display), EVENT_READABLE, on_wayland, NULL);
+	assert(source);
+	event_source_set_name(source, "wayland");
 
-	struct pollfd pollfds[] = {
-		[WAYLAND] = {
-			.fd = wl_display_get_fd(globals.wl_display),
-			.events = POLLIN,
-		},
-	};
+	// No other threads here, blocking the signals now is early enough
+	if ((source = event_loop_add_signal(loop, SIGINT, on_signal, NULL)))
+		event_source_set_name(source, "sigint");
+	if ((source = event_loop_add_signal(loop, SIGTERM, on_signal, NULL)))
+		event_source_set_name(source, "sigterm");
 
 	while (app.running) {
 		wl_display_flush(globals.wl_display);
 
-		poll(pollfds, sizeof(pollfds) / sizeof(pollfds[0]), -1);
-
-		if (pollfds[WAYLAND].revents & POLLIN)
-			wl_display_dispatch(globals.wl_display);
+		if (event_loop_dispatch(loop, -1) < 0)
+			break;
 	}
+
+	event_loop_print_stats(loop, stderr);
+	event_loop_destroy(loop);
 }
 
 void app_stop()
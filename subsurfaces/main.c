@@ -2,6 +2,8 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+#include "../common/pattern.h"
+
 #include "display.h"
 #include "window.h"
 #include "input.h"
@@ -20,16 +22,7 @@ static void on_close()
 
 static void on_draw(uint32_t *pixels, uint32_t time)
 {
-	for (int y=0; y<HEIGHT; y++) {
-		for (int x=0; x<WIDTH; x++) {
-			uint32_t d1 = time / 10;
-			uint32_t d2 = time / 5;
-			uint8_t r = (x + d2) ^ y;
-			uint8_t g = (x + d1) ^ (y + d2);
-			uint8_t b = x  ^ (y + d1);
-			pixels[y * WIDTH + x] = (r << 16) + (g << 8) + b;
-		}
-	}
+	pattern_fill(pixels, WIDTH, HEIGHT, time);
 }
 
 static void on_key(uint32_t key)
@@ -48,6 +41,10 @@ int main(int argc, char **argv)
 
   display = create_display();
   window = create_window(display, WIDTH, HEIGHT, on_draw, on_close);
+  if (!window) {
+	  destroy_display(display);
+	  return 1;
+  }
   input = create_input(display, on_key);
 
   while (running && wl_display_dispatch(display->wl_display) != -1) {
@@ -86,6 +86,12 @@ struct window *create_window(struct display *display, int width, int height, voi
 
 	window->buffers[0] = create_buffer(display, width, height);
 	window->buffers[1] = create_buffer(display, width, height);
+	if (!window->buffers[0] || !window->buffers[1]) {
+		if (window->buffers[0]) destroy_buffer(window->buffers[0]);
+		if (window->buffers[1]) destroy_buffer(window->buffers[1]);
+		free(window);
+		return NULL;
+	}
 
 	window->wl_surface = wl_compositor_create_surface(display->wl_compositor);
 	window->xdg_surface = xdg_wm_base_get_xdg_surface(display->xdg_wm_base,
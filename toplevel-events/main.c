@@ -1,25 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "app.h"
+#include "atlas.h"
+#include "bands.h"
+
+static void draw_rows(void *data, int width, int y0, int y1, void *arg)
+{
+	uint32_t *pixels = data;
+	int offset = *(int *) arg;
+
+	for (int y = y0; y < y1; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint8_t n = (x + offset) ^ y;
+			pixels[y * width + x] = (n << 16) + (n << 8) + n;
+		}
+	}
+}
+
+static void draw_period(void *pixels, int size, void *data)
+{
+	int offset = 0;
+
+	draw_rows(pixels, size, 0, size, &offset);
+}
+
+struct atlas_job {
+	const struct atlas *atlas;
+	int offset;
+};
+
+static void fill_rows(void *data, int width, int y0, int y1, void *arg)
+{
+	const struct atlas_job *job = arg;
 
-void draw(uint32_t *data, int offset)
+	atlas_fill(job->atlas, data, width * 4, 0, y0, width, y1 - y0, job->offset, 0);
+}
+
+// Moves the frame drawn for offset - dx over by dx and draws only the columns
+// that uncovers
+static void scroll(const struct atlas *atlas, uint32_t *data, int dx, int offset)
 {
-	for (int y = 0; y < 256; ++y) {
-		for (int x = 0; x < 256; ++x) {
+	const int width = 256, height = 256;
+	const int kept = width - dx;
+
+	for (int y = 0; y < height; ++y)
+		memmove(data + y * width, data + y * width + dx, kept * 4);
+
+	if (atlas) {
+		atlas_fill(atlas, data, width * 4, kept, 0, dx, height, offset, 0);
+		return;
+	}
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = kept; x < width; ++x) {
 			uint8_t n = (x + offset) ^ y;
-			data[y * 256 + x] = (n << 16) + (n << 8) + n;
+			data[y * width + x] = (n << 16) + (n << 8) + n;
 		}
 	}
 }
 
+// A NULL pool draws on the calling thread, a NULL atlas draws every pixel
+void draw(struct band_pool *pool, const struct atlas *atlas, uint32_t *data, int offset)
+{
+	if (atlas) {
+		struct atlas_job job = { atlas, offset };
+		band_pool_run(pool, data, 256, 0, 256, fill_rows, &job);
+	} else {
+		band_pool_run(pool, data, 256, 0, 256, draw_rows, &offset);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct app_state app = {0};
+	struct band_pool *pool = NULL;
+	struct atlas *atlas = NULL;
+	int use_scroll = 0;
 	int frame = 0;
+	int drawn = -1;
+
+	for (int i = 1; i < argc; i++) {
+		// 0 for one thread per CPU
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			pool = band_pool_create(atoi(argv[++i]));
+		// The pattern repeats every 256 pixels, draw it once and copy it
+		else if (strcmp(argv[i], "--atlas") == 0)
+			atlas = atlas_create(4, draw_period, NULL);
+		// Reuse the last frame, it only moves by a pixel
+		else if (strcmp(argv[i], "--scroll") == 0)
+			use_scroll = 1;
+	}
 
 	app_init(&app);
 
 	while (app_run(&app)) {
-		draw(app.buffer.data, ++frame);	
+		++frame;
+
+		if (use_scroll && drawn >= 0 && frame - drawn < 256)
+			scroll(atlas, app.buffer.data, frame - drawn, frame);
+		else
+			draw(pool, atlas, app.buffer.data, frame);
+
+		drawn = frame;
 	}
 
+	if (pool)
+		band_pool_destroy(pool);
+	if (atlas)
+		atlas_destroy(atlas);
+
 	return 0;
 }
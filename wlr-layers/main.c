@@ -1,5 +1,5 @@
 #include <assert.h>
-#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,7 +9,12 @@
 #include <wayland-client.h>
 
 #include "wlr-layer-shell-unstable-v1.h"
+#include "bands.h"
+#include "damage.h"
+#include "diff.h"
 #include "log.h"
+#include "loop.h"
+#include "premultiply.h"
 
 static struct {
 	struct wl_display *wl_display;
@@ -32,6 +37,14 @@ static struct {
 	int width;
 	int height;
 
+	struct damage_tracker damage_tracker;
+
+	// Set with --diff, damage comes from diffing frames
+	int infer_damage;
+	struct frame_diff diff;
+
+	struct event_loop *loop;
+
 	int running;
 } app;
 
@@ -139,9 +152,30 @@ static void frame(void *data, struct wl_callback *wl_callback, uint32_t time)
 	if (app.on_draw)
 		app.on_draw(buffer->pixels, buffer->width, buffer->height);
 
+	// on_draw writes straight alpha
+	premultiply_argb8888(buffer->pixels, buffer->width * 4, 0, 0,
+			buffer->width, buffer->height);
+
 	wl_surface_attach(surface.wl_surface, buffer->wl_buffer, 0, 0);
-	wl_surface_damage_buffer(surface.wl_surface, 0, 0, buffer->width,
-			buffer->height);
+
+	if (app.infer_damage) {
+		struct diff_rect rects[16];
+		int n = frame_diff_update(&app.diff, buffer->pixels, buffer->width,
+				buffer->height, 4, rects, sizeof(rects) / sizeof(rects[0]));
+
+		for (int i = 0; i < n; i++)
+			damage_tracker_add(&app.damage_tracker, rects[i].x, rects[i].y,
+					rects[i].width, rects[i].height);
+
+		LOG("Inferred %d damage rects, %.1f%% damaged so far", n,
+				100.0 * app.diff.damaged / app.diff.pixels);
+	} else {
+		damage_tracker_add(&app.damage_tracker, 0, 0, buffer->width, buffer->height);
+	}
+
+	damage_tracker_submit(&app.damage_tracker, surface.wl_surface,
+			buffer->width, buffer->height);
+
 	wl_surface_commit(surface.wl_surface);
 
 	buffer->busy = 1;
@@ -189,6 +223,17 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
 	.repeat_info = noop,
 };
 
+static void on_wayland(int fd, uint32_t mask, void *data)
+{
+	if (wl_display_dispatch(globals.wl_display) < 0)
+		app.running = 0;
+}
+
+static void on_signal(int signal, void *data)
+{
+	app.running = 0;
+}
+
 void app_init(int width, int height,
 		const char *title,
 		const char *app_id,
@@ -201,6 +246,8 @@ void app_init(int width, int height,
 	app.on_draw = on_draw;
 	app.running = 1;
 
+	damage_tracker_init(&app.damage_tracker, 8);
+
 	globals.wl_display = wl_display_connect(NULL);
 	globals.wl_registry = wl_display_get_registry(globals.wl_display);
 	wl_registry_add_listener(globals.wl_registry, &registry_listener, NULL);
@@ -227,40 +274,48 @@ void app_init(int width, int height,
 	// Set up input
 	struct wl_keyboard *wl_keyboard = wl_seat_get_keyboard(globals.wl_seat);
 	wl_keyboard_add_listener(wl_keyboard, &wl_keyboard_listener, NULL);
+
+	// Set up event loop. Signals are blocked here, before main() starts any
+	// threads, so the threads inherit the mask and the signals reach the loop.
+	app.loop = event_loop_create();
+
+	struct event_source *source = event_loop_add_fd(app.loop,
+			wl_display_get_fd(globals.wl_display), EVENT_READABLE, on_wayland, NULL);
+	assert(source);
+	event_source_set_name(source, "wayland");
+
+	if ((source = event_loop_add_signal(app.loop, SIGINT, on_signal, NULL)))
+		event_source_set_name(source, "sigint");
+	if ((source = event_loop_add_signal(app.loop, SIGTERM, on_signal, NULL)))
+		event_source_set_name(source, "sigterm");
 }
 
 void app_run()
 {
-	enum {
-		WAYLAND,
-		TIMER,
-	};
-
-	struct pollfd pollfds[] = {
-		[WAYLAND] = {
-			.fd = wl_display_get_fd(globals.wl_display),
-			.events = POLLIN,
-		},
-	};
-
 	while (app.running) {
 		wl_display_flush(globals.wl_display);
 
-		poll(pollfds, sizeof(pollfds) / sizeof(pollfds[0]), -1);
-
-		if (pollfds[WAYLAND].revents & POLLIN)
-			wl_display_dispatch(globals.wl_display);
+		if (event_loop_dispatch(app.loop, -1) < 0)
+			break;
 	}
+
+	damage_tracker_print_stats(&app.damage_tracker, stderr);
+	event_loop_print_stats(app.loop, stderr);
 }
 
+// Set with --threads N, NULL draws on the dispatch thread
+static struct band_pool *band_pool;
+
 static void on_key(uint32_t key)
 {
 	if (key == 1) app.running = 0;
 }
 
-static void on_draw(uint32_t *pixels, int width, int height)
+static void draw_rows(void *data, int width, int y0, int y1, void *unused)
 {
-	for (int y = 0; y < height; y++) {
+	uint32_t *pixels = data;
+
+	for (int y = y0; y < y1; y++) {
 		for (int x = 0; x < width; x++) {
 			uint8_t r = ((uint8_t) x ^ (uint8_t) y) * 0.2;
 			uint8_t g = ((uint8_t) x ^ (uint8_t) y) * 0.2;
@@ -271,11 +326,27 @@ static void on_draw(uint32_t *pixels, int width, int height)
 	}
 }
 
+static void on_draw(uint32_t *pixels, int width, int height)
+{
+	band_pool_run(band_pool, pixels, width, 0, height, draw_rows, NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	app_init(256, 256, "WLR layers", "learnwayland", on_key, on_draw);
 
+	for (int i = 1; i < argc; i++) {
+		// 0 for one thread per CPU
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			band_pool = band_pool_create(atoi(argv[++i]));
+		else if (strcmp(argv[i], "--diff") == 0)
+			app.infer_damage = 1;
+	}
+
 	app_run();
 
+	if (band_pool)
+		band_pool_destroy(band_pool);
+
 	return 0;
 }